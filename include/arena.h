@@ -0,0 +1,71 @@
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+
+#include "types.h"
+
+// Arena hands out memory by bumping a pointer through large blocks and
+// frees everything at once in release(). Individual allocations are never
+// freed, which suits build phases producing many short lived objects,
+// e.g. automaton construction in the lexer.
+class Arena {
+public:
+  Arena(size_t block_size = 1 << 16);
+  Arena(const Arena& other) = delete;
+  Arena& operator=(const Arena& other) = delete;
+
+  ~Arena();
+
+  void* allocate(size_t size, size_t alignment);
+  void release();
+
+  u64 bytesReserved();
+
+private:
+  struct Block {
+    Block* previous;
+  };
+
+  void addBlock(size_t min_size);
+
+  Block* current_block;
+  u8* block_itr;
+  u8* block_end;
+
+  size_t block_size;
+  u64 bytes_reserved;
+};
+
+// Standard library allocator drawing from an Arena, deallocation is a no-op.
+// Containers using it must not outlive the arena's next release().
+template <typename T>
+class ArenaAllocator {
+public:
+  typedef T value_type;
+
+  ArenaAllocator(Arena& arena) : arena(&arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T*, size_t) {}
+
+  Arena* arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) {
+  return lhs.arena == rhs.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) {
+  return lhs.arena != rhs.arena;
+}
+
+#endif // ARENA_H_
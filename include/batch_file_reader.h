@@ -0,0 +1,89 @@
+
+#ifndef BATCH_FILE_READER_H_
+#define BATCH_FILE_READER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "work_stealing_pool.h"
+
+// Yields the next path to read, false once there are none left.
+// May block, e.g. on a queue fed by a FileCrawler.
+typedef std::function<bool(std::string& path_out)> PathSource;
+
+// Receives the contents of one file on a pool worker. The contents are
+// only valid for the duration of the call. Empty files and files that
+// fail to read are skipped.
+typedef std::function<void(const std::string& file_path,
+                           const char* file_begin,
+                           const char* file_end,
+                           u32 worker)> LoadedFileHandler;
+
+struct IoRing; // platform specific asynchronous I/O backend
+
+// Reads whole files for a pool of workers, keeping many reads in flight
+// while the workers process the files already read.
+//
+// Where the kernel supports io_uring the opens, stats, reads and closes
+// of a batch of files are submitted together and completed asynchronously
+// by the thread calling readAll(), which then hands each file's buffer to
+// the pool. Elsewhere the pool's workers read files themselves through
+// FileMapper, reading small files into reused buffers and mapping larger
+// ones. Files larger than small_file_read_limit are mapped by the
+// workers either way.
+class BatchFileReader {
+public:
+  BatchFileReader(WorkStealingPool& pool,
+                  u32 small_file_read_limit = 1 << 16,
+                  u32 files_in_flight = 64);
+  BatchFileReader(const BatchFileReader& other) = delete;
+  BatchFileReader& operator=(const BatchFileReader& other) = delete;
+
+  ~BatchFileReader();
+
+  // Reads every path next_path yields and returns once on_loaded has
+  // returned for all of them. Must not be called from the pool's tasks.
+  void readAll(const PathSource& next_path, const LoadedFileHandler& on_loaded);
+
+  bool usesIoRing();
+
+private:
+  void readAllWithPool(const PathSource& next_path,
+                       const LoadedFileHandler& on_loaded);
+
+  // Reads a small file into the worker's buffer, or maps a larger one,
+  // and hands it to on_loaded. Runs on a pool worker.
+  void loadFile(const std::string& file_path,
+                std::vector<std::vector<char>>& worker_buffers,
+                const LoadedFileHandler& on_loaded,
+                u32 worker);
+
+  // Platform specific, see posix/ and win32/
+  void openIoRing();
+  void closeIoRing();
+  void readAllWithIoRing(const PathSource& next_path,
+                         const LoadedFileHandler& on_loaded);
+
+  // Files handed to the pool whose handler hasn't returned, bounded so
+  // reading can't run arbitrarily far ahead of the workers
+  void beginHandling();
+  void endHandling();
+  void waitForHandlingBelow(u32 limit);
+
+  WorkStealingPool& pool;
+  u32 small_file_read_limit;
+  u32 files_in_flight;
+
+  IoRing* io_ring; // nullptr without asynchronous I/O
+
+  std::mutex handling_lock;
+  std::condition_variable handling_done;
+  u32 files_handling;
+};
+
+#endif // BATCH_FILE_READER_H_
@@ -0,0 +1,86 @@
+
+#ifndef BOUNDED_QUEUE_H_
+#define BOUNDED_QUEUE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Multi producer, multi consumer FIFO holding at most capacity items.
+// Producers block while it is full, which keeps a fast pipeline stage
+// from running arbitrarily far ahead of a slow one. Once closed, pop()
+// drains what is left and then reports the end of the stream.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity);
+  BoundedQueue(const BoundedQueue& other) = delete;
+  BoundedQueue& operator=(const BoundedQueue& other) = delete;
+
+  // Blocks while full, false if the queue was closed
+  bool push(T item);
+  // Blocks while empty, false once closed and drained
+  bool pop(T& item_out);
+
+  void close();
+
+private:
+  std::mutex lock;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+
+  std::deque<T> items;
+  size_t capacity;
+  bool closed;
+};
+
+//BOUNDED QUEUE TEMPLATE DEFINTIONS
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity) :
+    capacity(capacity),
+    closed(false) {
+
+}
+
+template <typename T>
+bool
+BoundedQueue<T>::push(T item) {
+  std::unique_lock<std::mutex> guard(lock);
+  not_full.wait(guard, [this] { return closed || items.size() < capacity; });
+  if (closed) {
+    return false;
+  }
+  items.push_back(std::move(item));
+  guard.unlock();
+  not_empty.notify_one();
+  return true;
+}
+
+template <typename T>
+bool
+BoundedQueue<T>::pop(T& item_out) {
+  std::unique_lock<std::mutex> guard(lock);
+  not_empty.wait(guard, [this] { return closed || !items.empty(); });
+  if (items.empty()) {
+    return false;
+  }
+  item_out = std::move(items.front());
+  items.pop_front();
+  guard.unlock();
+  not_full.notify_one();
+  return true;
+}
+
+template <typename T>
+void
+BoundedQueue<T>::close() {
+  // Notifying under the lock lets a consumer destroy the queue as soon
+  // as it sees it closed
+  std::lock_guard<std::mutex> guard(lock);
+  closed = true;
+  not_full.notify_all();
+  not_empty.notify_all();
+}
+
+#endif // BOUNDED_QUEUE_H_
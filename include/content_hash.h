@@ -0,0 +1,11 @@
+#ifndef CONTENT_HASH_H_
+#define CONTENT_HASH_H_
+
+#include "types.h"
+
+// 64-bit hash of a file's contents, XXH64 of the length bytes at data.
+// Fast enough to run at the speed files are read at, which lets an index
+// tell a file whose contents changed from one that was merely touched.
+u64 hashContent(const void* data, u64 length, u64 seed = 0);
+
+#endif // CONTENT_HASH_H_
@@ -2,9 +2,79 @@
 #ifndef CPP_LEXER_H_
 #define CPP_LEXER_H_
 
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "lexer.h"
+#include "work_stealing_pool.h"
+#include "file_crawler.h"
+
+// Receives the tokens of one file on the worker which lexed it. Both the
+// file mapping and tokens are only valid for the duration of the call.
+typedef std::function<void(const std::string& file_path,
+                           const char* file_begin,
+                           const char* file_end,
+                           const TokenBuffer& tokens,
+                           u32 worker)> TokenizedFileHandler;
+
+// Receives the tokens a stream completed since the last call. Token i
+// begins at buffer + tokens.index[i] - buffer_offset, indices count from
+// the stream's beginning. Both are only valid for the duration of the call.
+typedef std::function<void(const char* buffer,
+                           u64 buffer_offset,
+                           const TokenBuffer& tokens)> TokenizedStreamHandler;
+
 void buildCppLexer();
+bool loadCppLexer(const void* tables_begin, u64 tables_size);
+bool saveCppLexer(const char* file_path);
+void serializeCppLexer(std::vector<u8>& tables_out);
 void feedLexer(const char* file_begin, const char* file_end);
 
+// Lexer::tokenize() with keywords and native types told apart from names.
+// Given a pool, large inputs are lexed with Lexer::tokenizeParallel().
+void tokenizeCpp(const char* input_begin,
+                 const char* input_end,
+                 TokenBuffer& tokens_out,
+                 WorkStealingPool* pool = nullptr);
+
+// Whether a token of tokenizeCpp() is a name, as opposed to a keyword,
+// native type, literal or delimiter
+bool isCppName(int token_id);
+
+// tokenizeCpp() over a stream which can't be mapped, e.g. a pipe from a
+// preprocessor or stdin. Read in chunks of chunk_size bytes and lexed
+// with a StreamingLexer, so memory stays bounded however long the stream
+// is. Returns false if reading failed, the tokens up to there were handled.
+bool tokenizeCppStream(FILE* input,
+                       const TokenizedStreamHandler& handler,
+                       size_t chunk_size = 1 << 16);
+
+// Files lexed by tokenizeCppFiles() and tokenizeCppSourceTree() are read
+// by a BatchFileReader. Without io_uring, files no larger than
+// max_file_size are read into a buffer each worker reuses and larger ones
+// are mapped.
+void setSmallFileReadLimit(u32 max_file_size);
+
+// Lexes every file across the pool's workers and returns once all of
+// them are done. The handler runs concurrently on different workers,
+// empty files and files that fail to read are skipped. Must not be
+// called from the pool's tasks.
+void tokenizeCppFiles(const std::vector<std::string>& file_paths,
+                      WorkStealingPool& pool,
+                      const TokenizedFileHandler& handler);
+
+// Lexes every file a FileCrawler finds below root_path. Discovery runs on
+// its own pool and overlaps with lexing, batches of found files are lexed
+// as soon as they are queued. Returns once the whole tree is lexed.
+void tokenizeCppSourceTree(const std::string& root_path,
+                           const CrawlOptions& options,
+                           WorkStealingPool& discovery_pool,
+                           WorkStealingPool& lexing_pool,
+                           const TokenizedFileHandler& handler);
+
 void lexerTestPrintAllTokens();
 void lexerTestPrintAllFunctionsCalledInFunctions();
 
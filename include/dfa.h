@@ -1,25 +1,625 @@
 
+#ifndef DFA_H_
+#define DFA_H_
+
+#include <map>
+#include <cassert>
+#include <vector>
+#include <cstring>
 #include <limits>
+#include <algorithm>
+
+#include "types.h"
+#include "utils.h"
+#include "arena.h"
+#include "nfa.h"
+
+// Serialized DFA tables, laid out in native byte order as
+//   DFABlobHeader | T accept_states[num_states] | S table[num_states][num_classes]
+// A blob is queried in place, e.g. straight out of a file mapping, so the
+// header keeps everything 8 byte aligned.
+struct DFABlobHeader {
+  u32 identifier;
+  u32 version;
+  u32 tag;           // Free for the owner, e.g. to identify the rule set
+  u8  state_width;   // sizeof(S)
+  u8  accept_width;  // sizeof(T)
+  u16 reserved;
+  u32 num_states;
+  u32 num_classes;
+  u8  class_map[256];
+};
 
+const u32 DFA_BLOB_IDENTIFIER = 0x41464444; // "DDFA"
+const u32 DFA_BLOB_VERSION    = 1;
+
+// DFA is compiled from a finished NFA through subset construction.
+// Every DFA state stands for the epsilon closure of a set of NFA states,
+// so querying costs a single table lookup per input character.
+//
+// Input bytes are first mapped to equivalence classes: bytes which every
+// state treats alike share a class, and a transition row only holds one
+// column per class instead of one per alphabet character. Bytes outside
+// of the a_size alphabet fall into a class that always leads to garbage.
 template <typename S, typename T, size_t a_size>
-class DFA : private FiniteAutomata<S, T, a_size> {
+class DFA {
 public: 
-  DFA();
+  // Construction temporaries are drawn from arena, the tables are not
+  template <typename NFA_S>
+  DFA(NFA<NFA_S, T, a_size>& nfa, Arena& arena);
+  // Copies other into a DFA with a different state type,
+  // S must be able to represent every state of other.
+  template <typename OTHER_S>
+  DFA(const DFA<OTHER_S, T, a_size>& other);
+  // Queries the tables of a serialized blob in place, the blob must be
+  // valid according to isValidBlob() and outlive the DFA.
+  DFA(const DFABlobHeader* blob);
   ~DFA();
 
-  std::vector<S> addRule(const char* expr, T token_id);
+  DFA(const DFA& other) = delete;
+  DFA& operator=(const DFA& other) = delete;
+
+  void minimize();
+
+  inline S transition(S input_state, unsigned char input_ch) const;
+  inline T stateType(S state) const;
+
+  size_t size() const;
+  size_t classCount() const;
+
+  u64 serializedSize() const;
+  void serialize(void* blob_out, u32 tag) const;
+  static bool isValidBlob(const void* blob, u64 blob_size);
+
+  static const S begin_state;
+  static const S garbage_state;
 
 private:
-  inline S transition(S input_state, char input_ch); 
-  inline void writeTransition(S out_state, S in_state, char in_ch);
-  inline void copyTransitions(S dest, S src);
+  template <typename OTHER_S, typename OTHER_T, size_t other_a_size>
+  friend class DFA;
 
-  inline T stateType(S state);
+  inline void writeTransition(S out_state, S in_state, u8 in_class);
   inline void writeStateType(S state, T type);
 
-  
   S makeState();
 
   void grow();
+  void mergeEquivalentClasses();
+
+  S* transition_table; // num_states rows of num_classes columns
+  T* accept_states;
+
+  size_t num_states;
+  size_t num_states_max;
+  size_t num_classes;
+
+  u8 class_map[256];
+
+  bool owns_tables; // false when viewing a serialized blob
 };
 
+//DFA TEMPLATE DEFINTIONS
+
+// Like the NFA, the DFA begins with a blackhole (garbage) state
+// and a start state. The garbage state represents the empty NFA set.
+template <typename S, typename T, size_t a_size>
+template <typename NFA_S>
+DFA<S, T, a_size>::DFA(NFA<NFA_S, T, a_size>& nfa, Arena& arena) :
+    transition_table(nullptr),
+    accept_states(nullptr),
+    num_states(0),
+    num_states_max(16),
+    num_classes(0),
+    owns_tables(true) {
+  static_assert(a_size <= 256, "DFA input is read one byte at a time");
+
+  // Bytes with identical NFA transition columns are interchangeable,
+  // and so will they be for every DFA state built from those columns.
+  typedef typename NFA<NFA_S, T, a_size>::StateSet NFAStateSet;
+  typedef std::vector<u64, ArenaAllocator<u64>> StateBitset;
+
+  std::vector<u8> class_representative;
+  {
+    const size_t nfa_size = nfa.size();
+    std::map<NFAStateSet, u8, std::less<NFAStateSet>,
+             ArenaAllocator<std::pair<const NFAStateSet, u8>>>
+      known_columns(arena);
+    NFAStateSet column(nfa_size, arena);
+
+    for (size_t ch = 0; ch < 256; ++ch) {
+      for (size_t nfa_state = 0; nfa_state < nfa_size; ++nfa_state) {
+        column[nfa_state] = ch < a_size ? nfa.transition(nfa_state, ch) :
+                                          nfa.garbage_state;
+      }
+      auto column_itr = known_columns.find(column);
+      if (column_itr == known_columns.end()) {
+        column_itr = known_columns.emplace(column, num_classes++).first;
+        class_representative.push_back(ch);
+      }
+      class_map[ch] = column_itr->second;
+    }
+  }
+
+  transition_table =
+    static_cast<S*>(
+      operator new(num_states_max * num_classes * sizeof(*transition_table)));
+
+  accept_states =
+    static_cast<T*>(
+      operator new(num_states_max * sizeof(*accept_states)));
+
+  // NFA state sets are dense bitsets, see NFA::epsilonClosure()
+  const size_t set_words = nfa.closureWords();
+  std::map<StateBitset, S, std::less<StateBitset>,
+           ArenaAllocator<std::pair<const StateBitset, S>>>
+    known_sets(arena);
+  std::vector<StateBitset, ArenaAllocator<StateBitset>> unresolved_sets(arena);
+
+  // The token accepted by a DFA state is taken from its lowest numbered
+  // accepting NFA state. NFA states are allocated in the order rules are
+  // added, which keeps the "earlier rule wins a tie" guarantee of the lexer.
+  auto acceptance = [&nfa](const StateBitset& state_set) {
+    for (size_t word = 0; word < state_set.size(); ++word) {
+      for (u64 bits = state_set[word]; bits != 0; bits &= bits - 1) {
+        T state_type = nfa.stateType(word * 64 + countTrailingZeros(bits));
+        if (state_type != 0) {
+          return state_type;
+        }
+      }
+    }
+    return T(0);
+  };
+
+  makeState(); // garbage_state
+
+  StateBitset begin_set(set_words, 0, arena);
+  nfa.unionEpsilonClosure(begin_set.data(), nfa.begin_state);
+  S dfa_begin_state = makeState();
+  writeStateType(dfa_begin_state, acceptance(begin_set));
+  known_sets.emplace(begin_set, dfa_begin_state);
+  unresolved_sets.push_back(std::move(begin_set));
+
+  NFAStateSet current_states(arena);
+  StateBitset next_set(set_words, 0, arena);
+  while (!unresolved_sets.empty()) {
+    StateBitset current_set = std::move(unresolved_sets.back());
+    unresolved_sets.pop_back();
+    const S current_state = known_sets[current_set];
+
+    current_states.clear();
+    for (size_t word = 0; word < set_words; ++word) {
+      for (u64 bits = current_set[word]; bits != 0; bits &= bits - 1) {
+        current_states.push_back(word * 64 + countTrailingZeros(bits));
+      }
+    }
+
+    for (size_t in_class = 0; in_class < num_classes; ++in_class) {
+      const u8 ch = class_representative[in_class];
+      if (ch >= a_size) {
+        continue;
+      }
+      std::fill(next_set.begin(), next_set.end(), 0);
+      bool is_garbage_set = true;
+      for (NFA_S nfa_state : current_states) {
+        NFA_S transition_state = nfa.transition(nfa_state, ch);
+        if (transition_state != nfa.garbage_state) {
+          nfa.unionEpsilonClosure(next_set.data(), transition_state);
+          is_garbage_set = false;
+        }
+      }
+      if (is_garbage_set) {
+        continue; // garbage_state is the default transition
+      }
+
+      auto known_itr = known_sets.find(next_set);
+      S next_state;
+      if (known_itr != known_sets.end()) {
+        next_state = known_itr->second;
+      } else {
+        next_state = makeState();
+        writeStateType(next_state, acceptance(next_set));
+        known_sets.emplace(next_set, next_state);
+        unresolved_sets.push_back(next_set);
+      }
+      writeTransition(next_state, current_state, in_class);
+    }
+  }
+
+  mergeEquivalentClasses();
+}
+
+template <typename S, typename T, size_t a_size>
+template <typename OTHER_S>
+DFA<S, T, a_size>::DFA(const DFA<OTHER_S, T, a_size>& other) :
+    transition_table(nullptr),
+    accept_states(nullptr),
+    num_states(other.num_states),
+    num_states_max(other.num_states),
+    num_classes(other.num_classes),
+    owns_tables(true) {
+  assert(other.num_states - 1 <= std::numeric_limits<S>::max());
+
+  transition_table =
+    static_cast<S*>(
+      operator new(num_states_max * num_classes * sizeof(*transition_table)));
+
+  accept_states =
+    static_cast<T*>(
+      operator new(num_states_max * sizeof(*accept_states)));
+
+  for (size_t i = 0; i < num_states * num_classes; ++i) {
+    transition_table[i] = static_cast<S>(other.transition_table[i]);
+  }
+  memcpy(accept_states, other.accept_states, num_states * sizeof(*accept_states));
+  memcpy(class_map, other.class_map, sizeof(class_map));
+}
+
+template <typename S, typename T, size_t a_size>
+DFA<S, T, a_size>::DFA(const DFABlobHeader* blob) :
+    num_states(blob->num_states),
+    num_states_max(blob->num_states),
+    num_classes(blob->num_classes),
+    owns_tables(false) {
+  assert(blob->state_width == sizeof(S) && blob->accept_width == sizeof(T));
+
+  const u8* blob_itr = reinterpret_cast<const u8*>(blob + 1);
+  accept_states = reinterpret_cast<T*>(const_cast<u8*>(blob_itr));
+  blob_itr += num_states * sizeof(*accept_states);
+  transition_table = reinterpret_cast<S*>(const_cast<u8*>(blob_itr));
+
+  memcpy(class_map, blob->class_map, sizeof(class_map));
+}
+
+template <typename S, typename T, size_t a_size>
+DFA<S, T, a_size>::~DFA() {
+  if (owns_tables) {
+    operator delete(transition_table);
+    operator delete(accept_states);
+  }
+}
+
+// Hopcroft's partition refinement. States start out partitioned by their
+// acceptance type, so two states accepting different tokens are never
+// merged, and blocks are split until every block agrees on which block
+// each input class leads to. Each block becomes a single state afterwards.
+template <typename S, typename T, size_t a_size>
+void
+DFA<S, T, a_size>::minimize() {
+  const size_t n = num_states;
+
+  // Inverse transitions, grouped per class then per target state:
+  // predecessors of state t on class c are
+  //   inverse[inverse_begin[c * (n + 1) + t] ; inverse_begin[c * (n + 1) + t + 1][
+  std::vector<size_t> inverse_begin(num_classes * (n + 1), 0);
+  std::vector<S> inverse(num_classes * n);
+  for (size_t in_class = 0; in_class < num_classes; ++in_class) {
+    size_t* begin_itr = inverse_begin.data() + in_class * (n + 1);
+    for (size_t state = 0; state < n; ++state) {
+      ++begin_itr[transition_table[state * num_classes + in_class] + 1];
+    }
+    for (size_t state = 0; state < n; ++state) {
+      begin_itr[state + 1] += begin_itr[state];
+    }
+    std::vector<size_t> write_itr(begin_itr, begin_itr + n);
+    for (size_t state = 0; state < n; ++state) {
+      S target = transition_table[state * num_classes + in_class];
+      inverse[in_class * n + write_itr[target]++] = state;
+    }
+  }
+
+  std::vector<std::vector<S>> blocks;
+  std::vector<size_t> block_of(n);
+  {
+    std::map<T, size_t> block_of_type;
+    for (size_t state = 0; state < n; ++state) {
+      auto type_itr = block_of_type.find(accept_states[state]);
+      if (type_itr == block_of_type.end()) {
+        type_itr = block_of_type.emplace(accept_states[state],
+                                         blocks.size()).first;
+        blocks.emplace_back();
+      }
+      block_of[state] = type_itr->second;
+      blocks[type_itr->second].push_back(state);
+    }
+  }
+
+  std::vector<size_t> worklist;
+  std::vector<bool> in_worklist(blocks.size(), true);
+  for (size_t block = 0; block < blocks.size(); ++block) {
+    worklist.push_back(block);
+  }
+
+  std::vector<bool> marked(n, false);
+  std::vector<S> marked_states;
+  std::vector<size_t> marked_count(blocks.size(), 0);
+  std::vector<size_t> touched_blocks;
+  std::vector<S> splitter;
+
+  while (!worklist.empty()) {
+    splitter = blocks[worklist.back()];
+    in_worklist[worklist.back()] = false;
+    worklist.pop_back();
+
+    for (size_t in_class = 0; in_class < num_classes; ++in_class) {
+      const size_t* begin_itr = inverse_begin.data() + in_class * (n + 1);
+      const S* class_inverse = inverse.data() + in_class * n;
+
+      for (S target : splitter) {
+        for (size_t i = begin_itr[target]; i < begin_itr[target + 1]; ++i) {
+          S state = class_inverse[i];
+          if (!marked[state]) {
+            marked[state] = true;
+            marked_states.push_back(state);
+            if (marked_count[block_of[state]]++ == 0) {
+              touched_blocks.push_back(block_of[state]);
+            }
+          }
+        }
+      }
+
+      for (size_t block : touched_blocks) {
+        if (marked_count[block] < blocks[block].size()) {
+          const size_t new_block = blocks.size();
+          blocks.emplace_back();
+          in_worklist.push_back(false);
+          marked_count.push_back(0);
+
+          std::vector<S> remaining;
+          for (S state : blocks[block]) {
+            if (marked[state]) {
+              blocks[new_block].push_back(state);
+              block_of[state] = new_block;
+            } else {
+              remaining.push_back(state);
+            }
+          }
+          blocks[block].swap(remaining);
+
+          if (in_worklist[block] ||
+              blocks[new_block].size() <= blocks[block].size()) {
+            worklist.push_back(new_block);
+            in_worklist[new_block] = true;
+          } else {
+            worklist.push_back(block);
+            in_worklist[block] = true;
+          }
+        }
+        marked_count[block] = 0;
+      }
+      touched_blocks.clear();
+
+      for (S state : marked_states) {
+        marked[state] = false;
+      }
+      marked_states.clear();
+    }
+  }
+
+  // Renumber so the garbage and begin states keep their fixed ids
+  std::vector<S> block_state(blocks.size(), garbage_state);
+  block_state[block_of[begin_state]] = begin_state;
+  S next_state = begin_state + 1;
+  for (size_t state = 0; state < n; ++state) {
+    const size_t block = block_of[state];
+    if (block != block_of[garbage_state] && block != block_of[begin_state] &&
+        block_state[block] == garbage_state) {
+      block_state[block] = next_state++;
+    }
+  }
+
+  S* new_transition_table =
+    static_cast<S*>(
+      operator new(num_states_max * num_classes * sizeof(*transition_table)));
+
+  for (size_t state = 0; state < n; ++state) {
+    const S new_state = block_state[block_of[state]];
+    for (size_t in_class = 0; in_class < num_classes; ++in_class) {
+      new_transition_table[new_state * num_classes + in_class] =
+        block_state[block_of[transition_table[state * num_classes + in_class]]];
+    }
+    accept_states[new_state] = accept_states[state];
+  }
+
+  operator delete(transition_table);
+  transition_table = new_transition_table;
+  num_states = next_state;
+
+  mergeEquivalentClasses();
+}
+
+template <typename S, typename T, size_t a_size>
+const S DFA<S, T, a_size>::garbage_state = std::numeric_limits<S>::min();
+
+template <typename S, typename T, size_t a_size>
+const S DFA<S, T, a_size>::begin_state = DFA<S, T, a_size>::garbage_state + 1;
+
+template <typename S, typename T, size_t a_size>
+S
+DFA<S, T, a_size>::transition(S in_state, unsigned char in_ch) const {
+  return transition_table[in_state * num_classes + class_map[in_ch]];
+}
+
+template <typename S, typename T, size_t a_size>
+T
+DFA<S, T, a_size>::stateType(S state) const {
+  return accept_states[state];
+}
+
+template <typename S, typename T, size_t a_size>
+size_t
+DFA<S, T, a_size>::size() const {
+  return num_states;
+}
+
+template <typename S, typename T, size_t a_size>
+size_t
+DFA<S, T, a_size>::classCount() const {
+  return num_classes;
+}
+
+template <typename S, typename T, size_t a_size>
+void
+DFA<S, T, a_size>::writeTransition(S out_state, S in_state, u8 in_class) {
+  transition_table[in_state * num_classes + in_class] = out_state;
+}
+
+template <typename S, typename T, size_t a_size>
+void
+DFA<S, T, a_size>::writeStateType(S state, T type) {
+  accept_states[state] = type;
+}
+
+template <typename S, typename T, size_t a_size>
+S
+DFA<S, T, a_size>::makeState() {
+  if (num_states >= num_states_max) {
+    grow();
+  }
+  memset(transition_table + num_states * num_classes,
+         0,
+         num_classes * sizeof(*transition_table));
+  accept_states[num_states] = 0;
+  return num_states++;
+}
+
+template <typename S, typename T, size_t a_size>
+void
+DFA<S, T, a_size>::grow() {
+  num_states_max <<= 1;
+
+  S* new_transition_table =
+    static_cast<S*>(
+      operator new(num_states_max * num_classes * sizeof(*transition_table)));
+
+  T* new_accept_states =
+    static_cast<T*>(
+      operator new(num_states_max * sizeof(*new_accept_states)));
+
+  memcpy(new_transition_table,
+         transition_table,
+         num_states * num_classes * sizeof(*transition_table));
+  memcpy(new_accept_states,
+         accept_states,
+         num_states * sizeof(*accept_states));
+
+  operator delete(transition_table);
+  operator delete(accept_states);
+
+  transition_table = new_transition_table;
+  accept_states = new_accept_states;
+}
+
+template <typename S, typename T, size_t a_size>
+u64
+DFA<S, T, a_size>::serializedSize() const {
+  return sizeof(DFABlobHeader) +
+         num_states * sizeof(*accept_states) +
+         num_states * num_classes * sizeof(*transition_table);
+}
+
+// blob_out must hold serializedSize() bytes and be aligned for T and S
+template <typename S, typename T, size_t a_size>
+void
+DFA<S, T, a_size>::serialize(void* blob_out, u32 tag) const {
+  DFABlobHeader* header = static_cast<DFABlobHeader*>(blob_out);
+  memset(header, 0, sizeof(*header));
+  header->identifier   = DFA_BLOB_IDENTIFIER;
+  header->version      = DFA_BLOB_VERSION;
+  header->tag          = tag;
+  header->state_width  = sizeof(S);
+  header->accept_width = sizeof(T);
+  header->num_states   = static_cast<u32>(num_states);
+  header->num_classes  = static_cast<u32>(num_classes);
+  memcpy(header->class_map, class_map, sizeof(class_map));
+
+  u8* blob_itr = reinterpret_cast<u8*>(header + 1);
+  memcpy(blob_itr, accept_states, num_states * sizeof(*accept_states));
+  blob_itr += num_states * sizeof(*accept_states);
+  memcpy(blob_itr,
+         transition_table,
+         num_states * num_classes * sizeof(*transition_table));
+}
+
+// A blob comes from disk, so nothing in it is trusted before lexing
+// indexes tables with it: every class and state id must be in range.
+template <typename S, typename T, size_t a_size>
+bool
+DFA<S, T, a_size>::isValidBlob(const void* blob, u64 blob_size) {
+  if (blob == nullptr || blob_size < sizeof(DFABlobHeader)) {
+    return false;
+  }
+  const DFABlobHeader* header = static_cast<const DFABlobHeader*>(blob);
+  if (header->identifier   != DFA_BLOB_IDENTIFIER ||
+      header->version      != DFA_BLOB_VERSION ||
+      header->state_width  != sizeof(S) ||
+      header->accept_width != sizeof(T) ||
+      header->num_states   <= begin_state ||
+      header->num_states - 1 > std::numeric_limits<S>::max() ||
+      header->num_classes  == 0 ||
+      header->num_classes  > 256) {
+    return false;
+  }
+
+  const u64 table_size = u64(header->num_states) * header->num_classes;
+  if (blob_size < sizeof(DFABlobHeader) +
+                  header->num_states * sizeof(T) +
+                  table_size * sizeof(S)) {
+    return false;
+  }
+
+  for (size_t ch = 0; ch < 256; ++ch) {
+    if (header->class_map[ch] >= header->num_classes) {
+      return false;
+    }
+  }
+
+  const S* table = reinterpret_cast<const S*>(
+    reinterpret_cast<const u8*>(header + 1) + header->num_states * sizeof(T));
+  for (u64 i = 0; i < table_size; ++i) {
+    if (table[i] >= header->num_states) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Classes that were distinct in the NFA may become indistinguishable once
+// unreachable or merged states are gone. Fold identical columns together
+// and rewrite the table in place.
+template <typename S, typename T, size_t a_size>
+void
+DFA<S, T, a_size>::mergeEquivalentClasses() {
+  std::map<std::vector<S>, u8> known_columns;
+  std::vector<u8> merged_class(num_classes);
+  std::vector<u8> kept_classes;
+  std::vector<S> column(num_states);
+
+  for (size_t in_class = 0; in_class < num_classes; ++in_class) {
+    for (size_t state = 0; state < num_states; ++state) {
+      column[state] = transition_table[state * num_classes + in_class];
+    }
+    auto column_itr = known_columns.find(column);
+    if (column_itr == known_columns.end()) {
+      column_itr = known_columns.emplace(column, kept_classes.size()).first;
+      kept_classes.push_back(in_class);
+    }
+    merged_class[in_class] = column_itr->second;
+  }
+
+  if (kept_classes.size() == num_classes) {
+    return;
+  }
+
+  for (size_t state = 0; state < num_states; ++state) {
+    for (size_t in_class = 0; in_class < kept_classes.size(); ++in_class) {
+      transition_table[state * kept_classes.size() + in_class] =
+        transition_table[state * num_classes + kept_classes[in_class]];
+    }
+  }
+  for (size_t ch = 0; ch < 256; ++ch) {
+    class_map[ch] = merged_class[class_map[ch]];
+  }
+  num_classes = kept_classes.size();
+}
+
+#endif // DFA_H_
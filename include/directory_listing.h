@@ -0,0 +1,39 @@
+
+#ifndef DIRECTORY_LISTING_H_
+#define DIRECTORY_LISTING_H_
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+struct DirectoryEntry {
+  std::string name;
+  bool is_directory;
+  bool is_regular_file;
+
+  u64 size;
+  // Platform specific, only meaningful compared against another
+  // modification_time of the same file
+  u64 modification_time;
+};
+
+// Lists the entries of a directory without descending into it. "." and
+// ".." are left out, as are symbolic links and other reparse points so
+// that walking a tree can't loop. False if the directory can't be read.
+bool listDirectory(const std::string& directory_path,
+                   std::vector<DirectoryEntry>& entries_out);
+
+// Attributes of the entry at file_path as listDirectory() would list
+// them, without its name. False if it doesn't exist or can't be read.
+bool statFile(const std::string& file_path, DirectoryEntry& entry_out);
+
+// Separator between a directory and an entry in paths listDirectory() takes
+const char directory_separator =
+#ifdef _WIN32
+  '\\';
+#else
+  '/';
+#endif
+
+#endif // DIRECTORY_LISTING_H_
@@ -0,0 +1,76 @@
+
+#ifndef FILE_CRAWLER_H_
+#define FILE_CRAWLER_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "bounded_queue.h"
+#include "work_stealing_pool.h"
+
+struct CrawledFile {
+  std::string path;
+  u64 size;
+  u64 modification_time; // as listed by listDirectory()
+};
+
+typedef std::vector<CrawledFile> CrawledFileBatch;
+
+struct CrawlOptions {
+  CrawlOptions();
+
+  // File name endings to keep, e.g. ".cc". Empty keeps every file.
+  std::vector<std::string> extensions;
+  // Entries whose name matches one of these are skipped, directories
+  // along with everything below them. '*' matches any run of characters
+  // and '?' any single one.
+  std::vector<std::string> ignore_patterns;
+
+  size_t batch_size;
+};
+
+// Discovery stage of indexing: walks a source tree on a pool, one task
+// per directory, and streams the files passing the options' filters in
+// batches into a bounded queue. Consumers lex the batches while the walk
+// goes on, and the queue is closed once the whole tree has been listed.
+class FileCrawler {
+public:
+  FileCrawler(const CrawlOptions& options,
+              WorkStealingPool& pool,
+              BoundedQueue<CrawledFileBatch>& batches_out);
+  FileCrawler(const FileCrawler& other) = delete;
+  FileCrawler& operator=(const FileCrawler& other) = delete;
+
+  // Returns right away, the crawler must outlive the closing of the queue
+  void crawl(const std::string& root_path);
+
+  u64 filesFound();
+
+private:
+  void crawlDirectory(const std::string& directory_path, u32 worker);
+  void addFile(CrawledFile file, u32 worker);
+  void finishDirectory();
+
+  bool isIgnored(const std::string& name);
+  bool hasWantedExtension(const std::string& name);
+
+  CrawlOptions options;
+  WorkStealingPool& pool;
+  BoundedQueue<CrawledFileBatch>& batches_out;
+
+  // Batches filling up, one per worker of the pool
+  std::vector<CrawledFileBatch> worker_batches;
+
+  // Directories submitted and not yet listed, the last one listed
+  // flushes every worker's batch and closes the queue
+  std::atomic<u64> directories_pending;
+  std::atomic<u64> files_found;
+};
+
+// Glob match supporting '*' and '?'
+bool matchesPattern(const char* pattern, const char* name);
+
+#endif // FILE_CRAWLER_H_
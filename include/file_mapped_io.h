@@ -17,19 +17,44 @@
 
 #include "types.h"
 
+enum class MapAccess : u8 {
+  // Shared writable mapping, e.g. an index database being built
+  READ_WRITE,
+  // Read only mapping of a file read at random, e.g. a loaded index
+  // database. Large mappings are backed by huge pages where the kernel
+  // allows it, which saves page faults and TLB entries.
+  READ_ONLY,
+  // Read only mapping of a file read once front to back, e.g. a source
+  // file being lexed. Its pages are read ahead and faulted in up front.
+  READ_SEQUENTIAL
+};
+
 class FileMapper {
 public:
-  FileMapper(const char* file_path);
+  FileMapper(const char* file_path,
+             MapAccess access = MapAccess::READ_WRITE);
   FileMapper(const FileMapper& other) = delete;
   FileMapper& operator=(const FileMapper& other) = delete;
 
   ~FileMapper();
 
   u64 getFileSize();
-  void* map(u64 byte_offset, u32 length);
-  void unmap(void* mapped_mem, u32 length);
+
+  // byte_offset must be a multiple of mapAlignment()
+  void* map(u64 byte_offset, u64 length);
+  void unmap(void* mapped_mem, u64 length);
+
+  // Copies length bytes at byte_offset into buffer_out. For small files
+  // this beats map() and unmap(), which cost a syscall pair and, once
+  // unmapped, a TLB shootdown across every core running the process.
+  bool read(u64 byte_offset, void* buffer_out, u64 length);
+
+  // Granularity of mapping offsets: the page size on posix, the
+  // allocation granularity on win32
+  static u64 mapAlignment();
 private:
   MapHandle handle; // File maps are done via this handle
+  MapAccess access;
 };
 
 #endif // FILE_MAPPED_IO_
@@ -1,70 +1,238 @@
+#ifndef INDEX_DATABASE_H_
+#define INDEX_DATABASE_H_
 
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "types.h"
 #include "file_mapped_io.h"
+#include "mapped_windows.h"
+#include "postings.h"
+#include "string_pool.h"
+#include "trigram_index.h"
+#include "work_stealing_pool.h"
+
+// Layout of the index database file:
+//
+//   IndexHeader                                at 0
+//   SectionEntry[header.section_count]         at header.section_table_offset
+//   sections, each starting at a multiple of   header.section_alignment
+//
+// Every structure is read in place from a mapping of the file, opening an
+// index only reads its header and section table. Integers are stored in
+// the byte order of the machine which built the index, a reader of the
+// other byte order rejects it by its magic number.
+struct IndexHeader {
+  static const u32 MAGIC = 0x58444943; // "CIDX" in little endian
+  static const u32 VERSION = 3;
+  static const u32 SECTION_ALIGNMENT = 4096;
+
+  u32 magic;
+  u32 version;
+  u32 section_count;
+  u32 section_alignment;
+  u64 section_table_offset;
+  u64 file_size; // truncated files are rejected
+  // When the build began, as the modification time of a file written
+  // then. Files modified since may have changed after they were read.
+  u64 build_time;
+};
+
+enum class SectionKind : u32 {
+  STRING_POOL = 1, // see string_pool.h
+  FILE_TABLE,
+  SYMBOL_TABLE,    // see postings.h
+  POSTINGS,
+  NAME_TRIGRAMS,   // see trigram_index.h
+  CONTENT_TRIGRAMS
+};
+
+struct SectionEntry {
+  SectionKind kind;
+  u32 reserved;
+  u64 offset;
+  u64 size;
+};
+
+// FILE_TABLE section: FileTableHeader, then FileRecord[file_count] in
+// file id order, then the paths the records point into.
+struct FileTableHeader {
+  u32 file_count;
+  u32 reserved;
+};
 
-#include <cassert>
+struct FileRecord {
+  u64 path_offset; // from the beginning of the section
+  u32 path_length;
+  u32 reserved;
+  u64 size;
+  // As statFile() listed it before the file was read, see partialBuild()
+  u64 modification_time;
+  u64 content_hash; // hashContent() of the contents indexed
+};
 
-// TODO: Better to pack header info into a struct and memcpy
-enum HeaderData {
-  FILE_INDENTIFIER = 0x0, // 4 bytes
-  DATABASE_VERSION = 0x4, // 4 bytes
-  FILES_COUNT      = 0x8, // 4 bytes
+enum class SearchStatus : u8 {
+  DONE,
+  INVALID_REGEX,     // see isValidRegex()
+  NO_TRIGRAM_SECTION
+};
 
-  TEST_COUNT       = 0xc, // 8 bytes     
-  TEST_OFFSET      = 0x14,  // 8 bytes
-  // etc...
-  HEADER_LAST      = TEST_OFFSET + 8
+struct RegexMatch {
+  u32 file_id;
+  u64 offset;
+  u32 length;
 };
 
 // Responsible for creating and maintaining the format and structure
 // of the index database file
 class DataBase {
 public:
+  // Opens the index at file_path if there is a valid one, otherwise the
+  // database stays empty until build().
   DataBase(const char* file_path);
   DataBase(const DataBase& other) = delete;
   DataBase& operator=(const DataBase& other) = delete;
 
   ~DataBase();
 
-  void load();
+  // Maps the header and section table, false if the file isn't a valid
+  // index of this version
+  bool load();
   void release();
+  bool isLoaded();
 
-  void build();
-  void partialBuild();
-  
-  template <typename T>
-  T readHeaderValue(HeaderData);
+  // Lexes the files across the pool's workers and replaces the index
+  // file with their index, loading it afterwards. The C++ lexer must be
+  // built or loaded. Files which are empty or fail to read are left out.
+  bool build(const std::vector<std::string>& file_paths,
+             WorkStealingPool& pool);
 
-  template <typename T>
-  void writeHeaderValue(HeaderData, T val);
+  // build() which only lexes the files that changed since the loaded
+  // index was built. A file is unchanged if its size and modification
+  // time match its file record and that time is older than the build,
+  // or else if the hash of its contents matches. A file modified as the
+  // build began may change again within the same clock tick after being
+  // read, so it's hashed, the way git checks racily clean entries.
+  //
+  // If the files are those indexed and all are unchanged, only their
+  // modification times and the build time are updated in place.
+  // Otherwise unchanged files keep their names, occurrences and
+  // trigrams, read back from the loaded index, and the index is written
+  // anew from them and the relexed files. It comes out the same as
+  // build() of the same files. Without a valid index to update this is
+  // build().
+  bool partialBuild(const std::vector<std::string>& file_paths,
+                    WorkStealingPool& pool);
+
+  u32 fileCount();
+  std::string filePath(u32 file_id);
+  u64 fileSize(u32 file_id);
+
+  // The names lexed from the indexed files are interned in the string
+  // pool, other tables refer to them by their string id
+  u32 stringCount();
+  bool findString(const char* string, u32 length, u32& id_out);
+  std::string internedString(u32 id);
+
+  // Appends where the name of string_id occurs, sorted by file id and
+  // offset, false if the index has no postings of it
+  bool findOccurrences(u32 string_id,
+                       std::vector<Occurrence>& occurrences_out);
+
+  // Regular expression search, in the syntax of regex.h, for matches
+  // anywhere within the interned names or the indexed files' contents.
+  // The trigram sections narrow the search down to the strings or files
+  // containing the trigrams every match must contain, only those are
+  // run through the automaton. Files are read again from their paths,
+  // by the pool's workers. Expressions which aren't well formed are
+  // rejected before anything is searched.
+  SearchStatus searchNames(const char* regex,
+                           std::vector<u32>& string_ids_out);
+  SearchStatus searchFiles(const char* regex,
+                           WorkStealingPool& pool,
+                           std::vector<RegexMatch>& matches_out);
 
 private:
-  FileMapper file_mapper;
-  
-  struct {
-    size_t offset_to_begin;
-    size_t map_len;
-    void* map_begin;
-    
-  } current_map;
-  
-  void* file_begin;
-};
+  // nullptr if the index has no such section
+  const SectionEntry* findSection(SectionKind kind);
 
-// Template definitions
+  // Pointer to the length bytes at offset within a section, nullptr if
+  // they aren't all within it. Valid until a few other accesses have
+  // happened. Lengths beyond the window size are read into spill.
+  const u8* sectionBytes(const SectionEntry& section,
+                         u64 offset,
+                         u64 length,
+                         std::vector<u8>& spill);
 
-template <typename T>
-T DataBase::readHeaderValue(HeaderData h_offset) {
-  assert(file_begin != nullptr);
-  
-  unsigned char* val_ptr = reinterpret_cast<unsigned char*>(file_begin) + h_offset;
-  return *reinterpret_cast<T*>(val_ptr);
+  bool readFileRecord(u32 file_id, FileRecord& record_out);
+
+  // Copies a whole section into bytes_out
+  bool readSection(const SectionEntry& section, std::vector<u8>& bytes_out);
+
+  // What partialBuild() keeps of the unchanged files. file_slots maps
+  // the ids of the files kept to where their names and trigrams go, the
+  // other files map to ~0. Names are appended as their string id and
+  // offset, by string id and then offset. False if a section is missing
+  // or malformed.
+  bool readFileNames(const std::vector<u32>& file_slots,
+                     std::vector<std::vector<u32>>& name_ids_out,
+                     std::vector<std::vector<u32>>& name_offsets_out);
+  bool readFileTrigrams(const std::vector<u32>& file_slots,
+                        std::vector<std::vector<u32>>& trigrams_out);
+  bool readStringPool(StringPool& string_pool_out);
+
+  // Moves an index file written aside over file_path and loads it
+  bool replaceIndexFile(const std::string& built_path);
+
+  // Writes the modification times of every file record whose time
+  // changed, then the build time, into the index file and reloads it
+  bool updateFileTimes(const std::vector<u64>& modification_times,
+                       u64 build_time);
+
+  bool readStringSpan(const SectionEntry& string_pool,
+                      u32 id,
+                      u64& begin_out,
+                      u64& end_out);
+
+  // Ids in a trigram section admitted by query, false if it admits all
+  bool trigramCandidates(const SectionEntry& trigram_table,
+                         const TrigramQuery& query,
+                         std::vector<u32>& ids_out);
+  // The ids containing trigram, sorted, none if reading them failed
+  void trigramIds(const SectionEntry& trigram_table,
+                  u32 trigram,
+                  std::vector<u32>& ids_out);
+
+  template <typename T>
+  bool readSectionValue(const SectionEntry& section, u64 offset, T& value_out);
+
+  std::string file_path;
+
+  // The database may exceed what is sensible to map whole, it is
+  // accessed through a few windows of it instead
+  FileMapper* file_mapper;
+  MappedWindows* windows;
+
+  IndexHeader header;
+  std::vector<SectionEntry> sections;
+  bool loaded;
 };
 
-template <typename T>
-void DataBase::writeHeaderValue(HeaderData h_offset, T val) {
-  assert(file_begin != nullptr);
+// Template definitions
 
-  unsigned char* val_ptr = reinterpret_cast<unsigned char*>(file_begin) + h_offset;
-  *reinterpret_cast<T*>(val_ptr) = val;
+template <typename T>
+bool
+DataBase::readSectionValue(const SectionEntry& section,
+                           u64 offset,
+                           T& value_out) {
+  std::vector<u8> spill;
+  const u8* value_ptr = sectionBytes(section, offset, sizeof(T), spill);
+  if (value_ptr == nullptr) {
+    return false;
+  }
+  memcpy(&value_out, value_ptr, sizeof(T));
+  return true;
 }
 
+#endif // INDEX_DATABASE_H_
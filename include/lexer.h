@@ -6,6 +6,10 @@
 
 #include "types.h"
 #include "nfa.h"
+#include "dfa.h"
+#include "arena.h"
+#include "line_index.h"
+#include "work_stealing_pool.h"
 
 // The regular expression documentation used by the lexer can be found
 // in regex.h
@@ -25,12 +29,7 @@ struct LexingIterator {
   const char* itr;
   const char* end;
 
-  const char* last_line_begin;
-  unsigned int line_count;
-
   const char* token_begin;
-  unsigned int token_line;
-  unsigned int token_column;
 };
 
 class Token {
@@ -41,10 +40,44 @@ public:
   u64 index;
   unsigned int length;
   int id;
-  unsigned int line_count;
-  unsigned int column_count;
 };
 
+// Structure of arrays output of Lexer::tokenize(), token i spans
+// [index[i] ; index[i] + length[i][ of the tokenized input.
+// Lines and columns are not tracked while tokenizing, a LineIndex
+// of the input resolves them from index when needed.
+struct TokenBuffer {
+  void clear();
+  size_t size() const;
+
+  std::vector<u64> index;
+  std::vector<u32> length;
+  std::vector<int> id;
+};
+
+// Shortcuts the scan takes over input it would otherwise walk one byte
+// at a time, derived from the DFA once it is built or loaded.
+struct ScanSkips {
+  static const u8 NO_SKIP = 0xff;
+
+  // Per state: the number of ASCII bytes (at most 3) leaving a state
+  // that loops on every other ASCII byte, e.g. the body of a comment.
+  // Input is skipped with SIMD up to the next such escape byte.
+  // NO_SKIP for states without a loop like this.
+  std::vector<u8> escape_count;
+  std::vector<u8> escape_bytes; // 3 per state
+
+  // Bytes which can't begin a token
+  bool dead_start[256];
+  // Whitespace can't begin a token, runs of it are skipped with SIMD
+  bool skip_whitespace;
+};
+
+// The lexer reads 7-bit ASCII, other bytes never take part in a token
+template <typename S>
+using LexerDFA = DFA<S, int, 1 << 7>;
+typedef NFA<u32, int, 1 << 7> LexerNFA;
+
 class Lexer {
 public:
   Lexer();
@@ -53,29 +86,165 @@ public:
   void addRule(const Regexpr regexpr, int token_id);
   void build();
 
+  // Built lexing tables can be saved and later used in place from a
+  // memory mapping of the file, which skips addRule() and build().
+  // ruleset_version guards against loading tables of other rules.
+  void serialize(std::vector<u8>& tables_out, u32 ruleset_version) const;
+  bool save(const char* file_path, u32 ruleset_version) const;
+  bool load(const void* tables_begin, u64 tables_size, u32 ruleset_version);
+
   void setStream(const char* input_data_begin, const char* input_data_end);
   const char* begin();
   
   Token nextToken();
   void rewind();  
+
+  // Once built or loaded the lexing tables are never written again, so
+  // threads can share one Lexer through the const members below as long
+  // as each of them lexes with a cursor of its own, e.g.
+  // LexingIterator cursor = {begin, begin, end, begin};
+  Token nextToken(LexingIterator& cursor) const;
+
+  // Line and column of a token from the current stream. The stream's
+  // newline index is built on the first call.
+  void position(const Token& token, u32& line_out, u32& column_out);
+
+  // Appends every token of [input_begin ; input_end[ to tokens_out
+  // in one pass. Independent of the stream given to setStream().
+  void tokenize(const char* input_begin,
+                const char* input_end,
+                TokenBuffer& tokens_out) const;
+
+  // tokenize() splitting a large input across the pool's workers.
+  // Chunks of about chunk_size bytes, cut after a line break, are lexed
+  // speculatively from the DFA's begin state as if a token started at
+  // each chunk's beginning. Stitching the chunks in order, the exact scan
+  // is resumed where the previous chunk left off and relexed token by
+  // token until one starts where the speculative scan had one, from
+  // there on both agree. A chunk cut inside a multi line comment thereby
+  // gets relexed only up to where the comment ends, at worst the chunk
+  // is relexed whole.
+  void tokenizeParallel(const char* input_begin,
+                        const char* input_end,
+                        TokenBuffer& tokens_out,
+                        WorkStealingPool& pool,
+                        size_t chunk_size = 1 << 20) const;
 private:
-  void rewindBackTo(LexingIterator& rewind_data, std::vector<unsigned int>& state_set);
+  friend class StreamingLexer;
+
+  void buildScanSkips();
+
+  template <typename S>
+  Token nextToken(const LexerDFA<S>& dfa, LexingIterator& cursor) const;
+
+  template <typename S>
+  void tokenize(const LexerDFA<S>& dfa,
+                const char* input_begin,
+                const char* input_end,
+                TokenBuffer& tokens_out) const;
+
+  // Lexes the tokens starting in [scan_begin ; scan_stop[, the last of
+  // which may extend up to input_end. Indices are relative to
+  // input_begin. Returns where the scan stopped, at or past scan_stop.
+  template <typename S>
+  const char* tokenizeRange(const LexerDFA<S>& dfa,
+                            const char* input_begin,
+                            const char* scan_begin,
+                            const char* scan_stop,
+                            const char* input_end,
+                            TokenBuffer& tokens_out) const;
+
+  template <typename S>
+  void tokenizeParallel(const LexerDFA<S>& dfa,
+                        const char* input_begin,
+                        const char* input_end,
+                        TokenBuffer& tokens_out,
+                        WorkStealingPool& pool,
+                        size_t chunk_size) const;
 
   LexingIterator lexing_data;
 
+  LineIndex line_index;
+  bool line_index_valid;
+
+  ScanSkips scan_skips;
+
   enum class LexingState : u8 {
     INITIALIZATION_PHASE,
     BUILD_PHASE,
     QUERY_PHASE
   } status;
 
+  // Size in bytes of the DFA state type, picked by build() or load()
+  // as the narrowest type that can number every state.
+  u8 state_width;
+
+  // Backs all automaton construction, released at the end of build()
+  Arena build_arena;
+
   // Lexer internally constructs NFA during build phase
   // which gets replaced with a DFA for lexing phase.
   union {
-//  DFA<unsigned int, int, 1 << 7>* dfa;
-    NFA<unsigned int, int, 1 << 7>* nfa;
+    LexerDFA<u8>*  dfa8;
+    LexerDFA<u16>* dfa16;
+    LexerDFA<u32>* dfa32;
+    LexerNFA*      nfa;
   };
 };
 
+// Lexes input arriving in pieces, e.g. read from a pipe or stdin,
+// without ever holding all of it. Across feed() calls only the bytes of
+// the token in progress are kept, along with the DFA state its match
+// reached, so memory stays bounded by the chunk size plus the longest
+// pending match and a comment spanning many chunks is still walked once.
+// Token indices count from the beginning of the whole input; the tokens
+// are the same Lexer::tokenize() finds in the input as one range.
+class StreamingLexer {
+public:
+  explicit StreamingLexer(const Lexer& lexer);
+
+  // Appends the tokens completed within [chunk_begin ; chunk_end[ to
+  // tokens_out. A match reaching the chunk's end is held back since the
+  // next chunk may extend it.
+  void feed(const char* chunk_begin,
+            const char* chunk_end,
+            TokenBuffer& tokens_out);
+
+  // Ends the input, appending the tokens held back
+  void finish(TokenBuffer& tokens_out);
+
+  // Starts over on a new input
+  void reset();
+
+  // Input from bufferOffset() on, holding the bytes of every token the
+  // latest feed() or finish() appended until either is called again.
+  // Token i begins at buffer() + index[i] - bufferOffset().
+  const char* buffer() const;
+  u64 bufferOffset() const;
+
+private:
+  template <typename S>
+  void lexBuffer(const LexerDFA<S>& dfa,
+                 bool input_ended,
+                 TokenBuffer& tokens_out);
+
+  const Lexer& lexer;
+
+  std::vector<char> buffer_data;
+  u64 buffer_offset;
+
+  // Positions within buffer_data. scan is where the next token is looked
+  // for, or where the pending match began while in_match.
+  size_t scan;
+  bool in_match;
+
+  // The pending match, continued at match_itr from match_state.
+  // match_end is 0 until an accepting state was seen.
+  u32 match_state;
+  size_t match_itr;
+  size_t match_end;
+  int match_id;
+};
+
 #endif // LEXER_H_
 
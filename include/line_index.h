@@ -0,0 +1,29 @@
+
+#ifndef LINE_INDEX_H_
+#define LINE_INDEX_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "types.h"
+
+// Offsets of every '\n' in a buffer, found with one vectorized pass.
+// Positions are resolved by binary search over the offsets, so lexing
+// never has to look for line breaks itself.
+//
+// Lines and columns are 1-based, a column counts bytes from the
+// beginning of its line.
+class LineIndex {
+public:
+  void build(const char* input_begin, const char* input_end);
+  void clear();
+
+  void resolve(u64 index, u32& line_out, u32& column_out);
+
+  size_t lineCount();
+
+private:
+  std::vector<u64> newline_offsets;
+};
+
+#endif // LINE_INDEX_H_
@@ -0,0 +1,80 @@
+
+#ifndef MAPPED_WINDOWS_H_
+#define MAPPED_WINDOWS_H_
+
+#include <vector>
+
+#include "types.h"
+#include "file_mapped_io.h"
+
+// Maps a file of any size through a few aligned windows instead of
+// whole, which keeps address space and page table use bounded for
+// index files beyond 4 GiB. Recently used windows stay mapped, so
+// accesses clustered in a few regions don't remap every time; the
+// least recently used window is the one replaced.
+class MappedWindows {
+public:
+  MappedWindows(FileMapper& file,
+                u64 window_size = 64ULL << 20,
+                u32 window_count = 4);
+  MappedWindows(const MappedWindows& other) = delete;
+  MappedWindows& operator=(const MappedWindows& other) = delete;
+
+  ~MappedWindows();
+
+  // Pointer to the length bytes at byte_offset, nullptr when they aren't
+  // all within the file or mapping failed. length must not exceed the
+  // window size. The bytes stay mapped until window_count accesses to
+  // other windows have happened since, or release().
+  // available_out receives how many bytes from byte_offset on are mapped
+  // contiguously, at least length.
+  u8* access(u64 byte_offset, u64 length, u64* available_out = nullptr);
+
+  void release();
+
+  u64 windowSize();
+  u64 fileSize();
+
+private:
+  struct Window {
+    u8* begin;
+    u64 byte_offset;
+    u64 length;
+    u64 last_use;
+  };
+
+  FileMapper& file;
+  u64 window_size;
+  u64 file_size;
+
+  std::vector<Window> windows;
+  u64 use_clock;
+};
+
+// Reads a file front to back, or from wherever it is seeked to, through
+// a sliding window of a MappedWindows. Windows are only mapped when the
+// cursor crosses their end. Other users of the same MappedWindows may
+// evict the cursor's window, so interleave at most window_count - 1 of
+// their accesses with the cursor's, or seek() again afterwards.
+class WindowCursor {
+public:
+  WindowCursor(MappedWindows& windows, u64 byte_offset = 0);
+
+  // Pointer to the next length bytes, which are then consumed. nullptr
+  // when fewer than length bytes are left.
+  const u8* next(u64 length);
+
+  void seek(u64 byte_offset);
+  u64 offset();
+  u64 remaining();
+
+private:
+  MappedWindows& windows;
+  u64 byte_offset;
+
+  // The span of the current window from byte_offset on
+  const u8* window_itr;
+  const u8* window_end;
+};
+
+#endif // MAPPED_WINDOWS_H_
@@ -2,31 +2,47 @@
 #ifndef NFA_H_
 #define NFA_H_
 
-#include <stack>
 #include <vector>
 #include <cstring>
 #include <iostream>
 #include <algorithm>
 
+#include "types.h"
+#include "utils.h"
 #include "finite_automata.h"
 #include "regex.h"
+#include "arena.h"
 
+// All memory of the NFA, including the state sets handed out by
+// addExprGroup(), is drawn from the arena passed on construction.
+// The NFA must be destroyed before the arena is released.
 template <typename S, typename T, size_t a_size>
 class NFA : private FiniteAutomata<S, T, a_size> {
 public: 
-  NFA();
+  typedef std::vector<S, ArenaAllocator<S>> StateSet;
+
+  NFA(Arena& arena);
   ~NFA();
 
-  std::vector<S> addExprGroup(const char* regex_group_begin,
-                              const char* regex_group_end,
-                              std::vector<S> state_start_set,
-                              ExpressionGroupQuantification grp_quantification);
+  StateSet addExprGroup(const char* regex_group_begin,
+                        const char* regex_group_end,
+                        StateSet state_start_set,
+                        ExpressionGroupQuantification grp_quantification);
   inline S transition(S input_state, char input_ch); 
   inline T stateType(S state);
   inline void writeStateType(S state, T type);
 
+  // Epsilon closures are precomputed once the NFA stops changing and
+  // stored as dense bitsets of closureWords() words, where bit s marks
+  // state s. Unions of closures are then plain word-wise ORs.
+  size_t closureWords();
+  const u64* epsilonClosure(S state);
+  inline void unionEpsilonClosure(u64* state_set, S state);
+
   std::vector<S> epsilonSearch(std::vector<S>& base_state); 
 
+  size_t size();
+
   static const S begin_state;
   static const S garbage_state;
 
@@ -40,7 +56,17 @@ private:
   void grow();
   void writeUnusedDefaultTransitions();
 
-  std::vector<S>* epsilon_transitions;
+  void buildEpsilonClosures();
+
+  template <typename E>
+  E* allocate(size_t count);
+
+  Arena& arena;
+
+  StateSet* epsilon_transitions;
+
+  std::vector<u64, ArenaAllocator<u64>> epsilon_closures;
+  bool epsilon_closures_valid;
 };
 
 //NFA TEMPLATE DEFINTIONS
@@ -53,23 +79,20 @@ private:
 // NFA always begins with 2 states:
 //  a blackhole (garbage) state and a start state.
 template <typename S, typename T, size_t a_size>
-NFA<S, T, a_size>::NFA() : FiniteAutomata<S, T, a_size> {nullptr,
-                                                         nullptr,
-                                                         2,
-                                                         10} {
-  this->transition_table =
-    static_cast<S(*)[a_size]>(
-      operator new(this->num_states_max * sizeof(*this->transition_table)));
-
-  this->accept_states =
-    static_cast<T*>(
-      operator new(this->num_states_max * sizeof(*this->accept_states)));
+NFA<S, T, a_size>::NFA(Arena& arena) :
+    FiniteAutomata<S, T, a_size> {nullptr,
+                                  nullptr,
+                                  2,
+                                  10},
+    arena(arena),
+    epsilon_closures(arena),
+    epsilon_closures_valid(false) {
+  this->transition_table = allocate<S[a_size]>(this->num_states_max);
+  this->accept_states = allocate<T>(this->num_states_max);
 
   this->accept_states[garbage_state] = this->accept_states[begin_state] = 0;  
   
-  this->epsilon_transitions = 
-    static_cast<std::vector<S>*>(
-      operator new(this->num_states_max * sizeof(*this->epsilon_transitions)));    
+  this->epsilon_transitions = allocate<StateSet>(this->num_states_max);
    
   memset(this->transition_table + garbage_state,
          0,
@@ -78,21 +101,25 @@ NFA<S, T, a_size>::NFA() : FiniteAutomata<S, T, a_size> {nullptr,
          0,
          sizeof(*this->transition_table)); 
 
-  new (this->epsilon_transitions + garbage_state) std::vector<S>();
-  new (this->epsilon_transitions + begin_state)   std::vector<S>();
+  new (this->epsilon_transitions + garbage_state) StateSet(arena);
+  new (this->epsilon_transitions + begin_state)   StateSet(arena);
 
   writeUnusedDefaultTransitions();
 }
 
 template <typename S, typename T, size_t a_size>
 NFA<S, T, a_size>::~NFA() {
-  operator delete(this->transition_table);
-  operator delete(this->accept_states);
-  
+  // Memory itself goes back when the arena is released
   for (unsigned int i = 0; i < this->num_states; ++i) {
-    this->epsilon_transitions[i].~vector();
+    this->epsilon_transitions[i].~StateSet();
   }
-  operator delete(this->epsilon_transitions);
+}
+
+template <typename S, typename T, size_t a_size>
+template <typename E>
+E*
+NFA<S, T, a_size>::allocate(size_t count) {
+  return static_cast<E*>(arena.allocate(count * sizeof(E), alignof(E)));
 }
 
 template <typename S, typename T, size_t a_size>
@@ -124,10 +151,17 @@ NFA<S, T, a_size>::writeStateType(S state, T type) {
   this->accept_states[state] = type;
 }
 
+template <typename S, typename T, size_t a_size>
+size_t
+NFA<S, T, a_size>::size() {
+  return this->num_states;
+}
+
 template <typename S, typename T, size_t a_size>
 void
 NFA<S, T, a_size>::addEpsilonTransition(S out_state, S in_state) {
   this->epsilon_transitions[in_state].push_back(out_state);
+  epsilon_closures_valid = false;
 }
 
 template <typename S, typename T, size_t a_size>
@@ -136,26 +170,21 @@ NFA<S, T, a_size>::makeState() {
   if (this->num_states >= this->num_states_max) {
     grow();
   }
-  new (this->epsilon_transitions + this->num_states) std::vector<S>();
+  new (this->epsilon_transitions + this->num_states) StateSet(arena);
+  epsilon_closures_valid = false;
   return this->num_states++;
 }
 
+// Outgrown arrays stay in the arena until it is released, the geometric
+// growth bounds that waste to the size of the final arrays.
 template <typename S, typename T, size_t a_size>
 void
 NFA<S, T, a_size>::grow() {
   this->num_states_max <<= 1;
 
-  S (*new_transition_table)[a_size] =
-    static_cast<S(*)[a_size]>(
-      operator new(this->num_states_max * sizeof(*new_transition_table)));
-
-  T* new_accept_states =
-    static_cast<T*>(
-      operator new(this->num_states_max * sizeof(*new_accept_states)));
-
-  std::vector<S>* new_epsilon_transitions =
-    static_cast<std::vector<S>*>(
-      operator new(this->num_states_max * sizeof(*new_epsilon_transitions)));
+  S (*new_transition_table)[a_size] = allocate<S[a_size]>(this->num_states_max);
+  T* new_accept_states = allocate<T>(this->num_states_max);
+  StateSet* new_epsilon_transitions = allocate<StateSet>(this->num_states_max);
   
   memcpy(new_transition_table,
          this->transition_table,
@@ -163,14 +192,12 @@ NFA<S, T, a_size>::grow() {
   memcpy(new_accept_states,
          this->accept_states,
          sizeof(*this->accept_states) * this->num_states);
-  memcpy(new_epsilon_transitions,
-         epsilon_transitions,
-         sizeof(*epsilon_transitions) * this->num_states);
+  for (size_t i = 0; i < this->num_states; ++i) {
+    new (new_epsilon_transitions + i)
+      StateSet(std::move(epsilon_transitions[i]));
+    epsilon_transitions[i].~StateSet();
+  }
 
-  operator delete(this->transition_table);
-  operator delete(this->accept_states);
-  operator delete(this->epsilon_transitions);
-  
   this->transition_table = new_transition_table;
   this->accept_states = new_accept_states;
   this->epsilon_transitions = new_epsilon_transitions;
@@ -193,10 +220,10 @@ NFA<S, T, a_size>::writeUnusedDefaultTransitions() {
 }
 
 template <typename S, typename T, size_t a_size>
-std::vector<S>
+typename NFA<S, T, a_size>::StateSet
 NFA<S, T, a_size>::addExprGroup(const char* regex_group_begin,
                   const char* regex_group_end,
-                  std::vector<S> start_state_set,
+                  StateSet start_state_set,
                   ExpressionGroupQuantification grp_quantification) {
   //  [regex_begin ; regex_end[ is a complete sub expression to be baked into
   //  start_state_set. The expression can contain children sub expression(s).
@@ -208,9 +235,9 @@ NFA<S, T, a_size>::addExprGroup(const char* regex_group_begin,
   //
   //  Recursively deal with all sub-expressions with a depth-first approach.
 
-  std::vector<S> next_state_set = start_state_set;
-  std::vector<S> current_state_set;
-  std::vector<S> group_final_state_set;
+  StateSet next_state_set = start_state_set;
+  StateSet current_state_set(arena);
+  StateSet group_final_state_set(arena);
 
   // The state set where the cycle begins, for e.g. *, +, or {n,m}
   S intermediate_state      = garbage_state;
@@ -276,6 +303,9 @@ NFA<S, T, a_size>::addExprGroup(const char* regex_group_begin,
 
       const char* subexpr_group_begin = nullptr;
       const char* subexpr_group_end   = nullptr;
+      // Malformed expressions end the group where the error is found,
+      // isValidRegex() screens expressions not known to be well formed
+      bool bad_regex = false;
 
 
       switch (*regex_itr) {
@@ -285,6 +315,12 @@ NFA<S, T, a_size>::addExprGroup(const char* regex_group_begin,
           // and interpret it as a char value
           subexpr_group_begin = regex_itr;
           ++regex_itr;
+          if (regex_itr == regex_group_end) {
+            std::cerr << "Bad regular expression: '\\' at the end";
+            std::cerr << std::endl;
+            bad_regex = true;
+            break;
+          }
           transition_buffer[*regex_itr] = true;
           regex_itr = subexpr_group_end = regex_itr + 1;
           break;
@@ -299,13 +335,14 @@ NFA<S, T, a_size>::addExprGroup(const char* regex_group_begin,
           subexpr_group_begin = regex_itr;
 
           for (int depth = 1;
-               depth != 0;
+               depth != 0 && !bad_regex;
                ++regex_itr) {
 
             switch (*regex_itr) {
               case '\0': {
                 std::cerr << "Bad regular expression: no matching ')' for '('";
                 std::cerr << std::endl;
+                bad_regex = true;
                 break;
               }
               case '(': {
@@ -325,6 +362,7 @@ NFA<S, T, a_size>::addExprGroup(const char* regex_group_begin,
         case ')': {
           std::cerr << "Bad regular expression: no matching '(' for ')'";
           std::cerr << std::endl;
+          bad_regex = true;
           break;
         }
         case '|': {
@@ -350,11 +388,13 @@ NFA<S, T, a_size>::addExprGroup(const char* regex_group_begin,
           // buffer the first value in case we see range based expression
           // e.g. [A-Z], store 'A' in first_val buffer
           char first_val;
-          while (*look_ahead != ']') {
+          while (*look_ahead != ']' && !bad_regex) {
             switch (*look_ahead) {
               case '\0': {
                 std::cerr << "Bad regular expression: no matching ']' for '['";
                 std::cerr << std::endl;
+                bad_regex = true;
+                continue;
               }
               case '-': {
                 ++look_ahead;
@@ -408,6 +448,10 @@ NFA<S, T, a_size>::addExprGroup(const char* regex_group_begin,
         }
       }
 
+      if (bad_regex) {
+        break;
+      }
+
       ExpressionGroupQuantification quant;
       int quantification_length = quant.quantifyOnString(regex_itr);
 
@@ -496,31 +540,86 @@ NFA<S, T, a_size>::addExprGroup(const char* regex_group_begin,
   return group_final_state_set;
 }
 
-// Only peeks in one epsilon transition depth.
-// Deeper transitions should never occurr.
+template <typename S, typename T, size_t a_size>
+size_t
+NFA<S, T, a_size>::closureWords() {
+  return (this->num_states + 63) / 64;
+}
+
+template <typename S, typename T, size_t a_size>
+const u64*
+NFA<S, T, a_size>::epsilonClosure(S state) {
+  if (!epsilon_closures_valid) {
+    buildEpsilonClosures();
+  }
+  return epsilon_closures.data() + state * closureWords();
+}
+
+template <typename S, typename T, size_t a_size>
+void
+NFA<S, T, a_size>::unionEpsilonClosure(u64* state_set, S state) {
+  const u64* closure = epsilonClosure(state);
+  const size_t words = closureWords();
+  for (size_t i = 0; i < words; ++i) {
+    state_set[i] |= closure[i];
+  }
+}
+
+// Depth first search from every state. A state reached whose closure
+// is already complete contributes its whole row at once, and a state is
+// never revisited, so epsilon cycles terminate.
+template <typename S, typename T, size_t a_size>
+void
+NFA<S, T, a_size>::buildEpsilonClosures() {
+  const size_t words = closureWords();
+  epsilon_closures.assign(this->num_states * words, 0);
+
+  StateSet epsilon_states(arena);
+  for (size_t state = 0; state < this->num_states; ++state) {
+    u64* closure = epsilon_closures.data() + state * words;
+    closure[state / 64] |= u64(1) << (state % 64);
+    epsilon_states.push_back(state);
+
+    while (!epsilon_states.empty()) {
+      S expanded_state = epsilon_states.back();
+      epsilon_states.pop_back();
+
+      const size_t n = this->epsilon_transitions[expanded_state].size();
+      for (size_t i = 0; i < n; ++i) {
+        S transition = this->epsilon_transitions[expanded_state][i];
+        const u64 transition_bit = u64(1) << (transition % 64);
+        if (closure[transition / 64] & transition_bit) {
+          continue;
+        }
+        if (transition < state) {
+          const u64* complete_closure =
+            epsilon_closures.data() + transition * words;
+          for (size_t word = 0; word < words; ++word) {
+            closure[word] |= complete_closure[word];
+          }
+        } else {
+          closure[transition / 64] |= transition_bit;
+          epsilon_states.push_back(transition);
+        }
+      }
+    }
+  }
+  epsilon_closures_valid = true;
+}
+
+// Returns the epsilon closure of base_states in ascending state order
 template <typename S, typename T, size_t a_size>
 std::vector<S>
 NFA<S, T, a_size>::epsilonSearch(std::vector<S>& base_states) {
+  std::vector<u64> state_set(closureWords(), 0);
+  for (S state : base_states) {
+    unionEpsilonClosure(state_set.data(), state);
+  }
 
-  std::vector<S> expanded_states = base_states; 
-  std::stack<S, std::vector<S>> epsilon_states(base_states);
-
-  while (epsilon_states.size() != 0) {
-    S state = epsilon_states.top();
-    epsilon_states.pop();
-    // Foreach loop seems to be bugged on MSVC on debug mode?
-    // i.e. for (S transition : this->epsilon_transitions[state]) {...}
-    const size_t n = this->epsilon_transitions[state].size();
-    for (size_t i = 0; i < n; ++i) {
-      S transition = this->epsilon_transitions[state][i];
-      if (std::find(expanded_states.begin(),
-                    expanded_states.end(),
-                    transition) == expanded_states.end()) {
-        expanded_states.push_back(transition);
-        
-      }
-      // put on epsilon stack to look for further epsilon transitions
-      epsilon_states.push(transition);
+  std::vector<S> expanded_states;
+  for (size_t word = 0; word < state_set.size(); ++word) {
+    for (u64 bits = state_set[word]; bits != 0; bits &= bits - 1) {
+      expanded_states.push_back(word * 64 + countTrailingZeros(bits));
     }
   }
   return expanded_states;
@@ -0,0 +1,78 @@
+#ifndef POSTINGS_H_
+#define POSTINGS_H_
+
+#include <vector>
+
+#include "types.h"
+
+// Postings of the index database: for every interned name, the sorted
+// places it occurs at.
+//
+// SYMBOL_TABLE section: SymbolTableHeader, then SymbolEntry[symbol_count]
+// indexed by string id.
+//
+// POSTINGS section: the encoded postings of every symbol one after the
+// other. A symbol occurring in file_count files, occurrence_count times
+// in total, is encoded as one stream of 2 * file_count + occurrence_count
+// values:
+//
+//   file id deltas      file_count values, from the previous file id,
+//                       the first one from 0
+//   occurrence counts   file_count values, per file
+//   offset deltas       occurrence_count values, from the previous offset
+//                       in the same file, the first one per file from 0
+//
+// Values are stored with encodeValues(), small deltas mostly take one
+// byte each.
+struct SymbolTableHeader {
+  u32 symbol_count;
+  u32 reserved;
+};
+
+struct SymbolEntry {
+  u64 postings_offset; // from the beginning of the POSTINGS section
+  u32 postings_size;
+  u32 file_count;
+  u32 occurrence_count;
+  u32 reserved;
+};
+
+struct Occurrence {
+  u32 file_id;
+  u32 offset; // byte offset of the name within the file
+};
+
+// Stream VByte: values are coded in groups of 4 by a control byte holding
+// the byte length (1 to 4) of each value in 2 bits, followed by the data
+// bytes of the group. All control bytes come first, then all data bytes,
+// which lets a group be decoded with one shuffle of 16 data bytes.
+// Returns the number of bytes appended.
+u64 encodeValues(const u32* values, u32 count, std::vector<u8>& bytes_out);
+
+// Decodes count values from [bytes_begin ; bytes_end[ and returns the end
+// of the bytes consumed, nullptr if they ended before count values.
+// SSSE3 shuffles 4 values at once where the CPU supports it.
+const u8* decodeValues(const u8* bytes_begin,
+                       const u8* bytes_end,
+                       u32 count,
+                       u32* values_out);
+
+// Turns values into their differences to the value before, the first one
+// to 0, and back into running sums
+void deltaEncode(u32* values, u32 count);
+void prefixSum(u32* values, u32 count);
+
+// Appends the encoded postings of a symbol occurring at occurrences,
+// sorted by file id and then offset, and fills entry_out in
+void encodePostings(const Occurrence* occurrences,
+                    u32 occurrence_count,
+                    std::vector<u8>& postings_out,
+                    SymbolEntry& entry_out);
+
+// Decodes the postings of entry, whose encoded bytes begin at postings,
+// false if they are malformed
+bool decodePostings(const SymbolEntry& entry,
+                    const u8* postings,
+                    std::vector<Occurrence>& occurrences_out);
+
+#endif // POSTINGS_H_
@@ -51,4 +51,12 @@ struct ExpressionGroupQuantification {
   const int INFINITE_OCCURRENCES = -1;
 };
 
+// Whether regex is well formed in the syntax above: ASCII only, every
+// '(' and '[' closed, no '\\' at the end, ranges with both ends and
+// {n,m} quantifiers of at most max_regex_repetitions with n <= m. The
+// automata are built from expressions assumed to be well formed, those
+// not hard-coded should be checked first.
+const int max_regex_repetitions = 1000;
+bool isValidRegex(const char* regex);
+
 #endif // REGEX_H_
@@ -0,0 +1,22 @@
+
+#ifndef SIMD_SCAN_H_
+#define SIMD_SCAN_H_
+
+#include "types.h"
+
+// Vectorized byte scanning kernels used to skip over input the lexer
+// would otherwise walk one byte at a time. AVX2 or SSE2 is used when the
+// target supports it, otherwise the kernels fall back to scalar loops.
+
+// Returns the first byte in [begin ; end[ that is one of the
+// byte_count (at most 3) stop_bytes or a non-ASCII byte, end if none is.
+const char* findStopByte(const char* begin,
+                         const char* end,
+                         const u8* stop_bytes,
+                         u32 byte_count);
+
+// Returns the first byte in [begin ; end[ which is not one of
+// ' ', '\t', '\r' and '\n', end if there is none.
+const char* skipWhitespace(const char* begin, const char* end);
+
+#endif // SIMD_SCAN_H_
@@ -0,0 +1,70 @@
+#ifndef STRING_POOL_H_
+#define STRING_POOL_H_
+
+#include <vector>
+
+#include "types.h"
+
+// STRING_POOL section of the index database, an open addressing hash
+// table of the interned strings laid out to be probed in place:
+//
+//   StringPoolHeader
+//   u64  string_offsets[string_count + 1]  string id spans
+//                                          [string_offsets[id] ;
+//                                           string_offsets[id + 1][
+//                                          of the string bytes
+//   u32  slots[slot_count]                 at slots_offset, id + 1 of the
+//                                          string hashed there, 0 if empty
+//   char string_bytes[]                    at bytes_offset
+//
+// slot_count is a power of two, a string is found by probing slots
+// linearly from hashString() modulo slot_count up to an empty one.
+struct StringPoolHeader {
+  u32 string_count;
+  u32 slot_count;
+  u64 slots_offset; // from the beginning of the section
+  u64 bytes_offset;
+};
+
+// FNV-1a, which the slot of a string in the pool is derived from
+inline u32
+hashString(const char* string, u32 length) {
+  u32 hash = 0x811c9dc5;
+  for (u32 i = 0; i < length; ++i) {
+    hash = (hash ^ static_cast<u8>(string[i])) * 0x01000193;
+  }
+  return hash;
+}
+
+// Interns strings, e.g. the names lexed from source files, storing each
+// distinct one once. Strings are numbered in the order they were first
+// interned and keep their id for the lifetime of the pool, so tables
+// referring to strings can store 4 byte ids and compare them instead.
+class StringPool {
+public:
+  StringPool();
+
+  // Id of the string, which is added if it isn't interned yet
+  u32 intern(const char* string, u32 length);
+  bool find(const char* string, u32 length, u32& id_out) const;
+
+  const char* string(u32 id) const;
+  u32 length(u32 id) const;
+  u32 size() const;
+
+  // Appends the pool as a STRING_POOL section
+  void serialize(std::vector<u8>& bytes_out) const;
+  // Replaces the pool with the one a STRING_POOL section of size bytes
+  // holds, keeping its ids. False if the section is malformed.
+  bool deserialize(const u8* section, u64 size);
+
+private:
+  bool equals(u32 id, const char* string, u32 length) const;
+  void grow();
+
+  std::vector<char> string_bytes;
+  std::vector<u64> string_offsets;
+  std::vector<u32> slots;
+};
+
+#endif // STRING_POOL_H_
@@ -0,0 +1,65 @@
+#ifndef TRIGRAM_INDEX_H_
+#define TRIGRAM_INDEX_H_
+
+#include <vector>
+
+#include "types.h"
+
+// Trigram sections of the index database, NAME_TRIGRAMS over the strings
+// of the string pool and CONTENT_TRIGRAMS over the indexed files:
+//
+//   TrigramTableHeader
+//   TrigramEntry[trigram_count]   sorted by trigram
+//   id lists                      per entry, the ascending string or file
+//                                 ids containing its trigram, delta coded
+//                                 and stored with encodeValues()
+//
+// A trigram is 3 consecutive bytes packed as b0 << 16 | b1 << 8 | b2.
+struct TrigramTableHeader {
+  u32 trigram_count;
+  u32 reserved;
+};
+
+struct TrigramEntry {
+  u32 trigram;
+  u32 id_count;
+  u64 ids_offset; // from the beginning of the section
+  u32 ids_size;
+  u32 reserved;
+};
+
+// Boolean filter over trigrams a regular expression's matches must
+// contain, used to narrow a search down to the ids which may match
+// before running the automaton on them. ALL admits everything, AND and
+// OR combine trigrams and subqueries.
+struct TrigramQuery {
+  enum class Op : u8 {
+    ALL,
+    AND,
+    OR
+  };
+
+  TrigramQuery();
+
+  Op op;
+  std::vector<u32> trigrams;
+  std::vector<TrigramQuery> subqueries;
+};
+
+// Appends the distinct trigrams of [begin ; end[ to trigrams_out, in
+// order of first appearance. seen is a bitmap of 1 << 24 bits, clear on
+// entry and left clear, which callers reuse across inputs.
+void collectTrigrams(const char* begin,
+                     const char* end,
+                     std::vector<u64>& seen,
+                     std::vector<u32>& trigrams_out);
+
+// The trigram filter of a regular expression in the syntax of regex.h,
+// matching anywhere within the searched text. Follows the analysis of
+// Russ Cox's "Regular Expression Matching with a Trigram Index": the
+// sets of strings a subexpression matches exactly, or else its possible
+// prefixes and suffixes, are tracked while they stay small and turned
+// into trigrams where they meet.
+TrigramQuery regexTrigramQuery(const char* regex);
+
+#endif // TRIGRAM_INDEX_H_
@@ -2,6 +2,12 @@
 #ifndef UTILS_H_
 #define UTILS_H_
 
+#include <utility>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include "types.h"
 
 // Only works for little endian architectures
@@ -10,6 +16,26 @@ inline void unpack(u64 in_val, u32& out_high_order, u32& out_low_order) {
   out_high_order = static_cast<u32>(in_val >> 32);
 }
 
+// Index of the lowest set bit, val must not be 0
+inline u32 countTrailingZeros(u64 val) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, val);
+  return index;
+#else
+  return __builtin_ctzll(val);
+#endif
+}
+
+// Number of set bits in val
+inline u32 countSetBits(u64 val) {
+#ifdef _MSC_VER
+  return static_cast<u32>(__popcnt64(val));
+#else
+  return __builtin_popcountll(val);
+#endif
+}
+
 // For easy type deduced allocations
 // e.g. T* a; a = type_deduced_new(a, ...);
 template <class T, class... Arg>
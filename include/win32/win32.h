@@ -7,8 +7,9 @@
 #include "types.h"
 
 struct MapHandle {
-  HANDLE file_handle;
+  HANDLE file_handle; // of the file mapping
   u64    file_size;
+  HANDLE disk_handle; // of the file itself, used by FileMapper::read()
 };
 
 #endif // WIN32_H_
@@ -0,0 +1,78 @@
+
+#ifndef WORK_STEALING_POOL_H_
+#define WORK_STEALING_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+
+// Fixed set of worker threads, each owning a deque of tasks. A worker
+// takes its newest task from the back of its own deque and, once that
+// is empty, steals the oldest task from the front of another worker's.
+// Uneven tasks, e.g. lexing files of very different sizes, thereby
+// spread across all workers without a central queue everyone fights
+// over.
+//
+// Tasks learn the index of the worker running them, which lets them
+// reuse per-worker state such as token buffers without locking.
+class WorkStealingPool {
+public:
+  typedef std::function<void(u32 worker)> Task;
+
+  // worker_count 0 picks one worker per hardware thread
+  explicit WorkStealingPool(u32 worker_count = 0);
+  WorkStealingPool(const WorkStealingPool& other) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool& other) = delete;
+
+  // Finishes every submitted task before joining the workers
+  ~WorkStealingPool();
+
+  // Called from a worker the task lands in that worker's own deque,
+  // otherwise submissions are dealt round-robin over the workers.
+  void submit(Task task);
+
+  // Blocks until every task submitted so far has finished. Must not be
+  // called from a task, use parallelFor() there.
+  void wait();
+
+  // Runs body(i, worker) for every i in [0 ; count[ and returns once all
+  // of those calls are done. A worker calling this runs pool tasks while
+  // it waits, so tasks may split their own work with it.
+  void parallelFor(size_t count,
+                   const std::function<void(size_t i, u32 worker)>& body);
+
+  u32 workerCount();
+
+private:
+  struct WorkerQueue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  void workerLoop(u32 worker);
+  bool popTask(u32 worker, Task& task_out);
+  bool tryRunTask(u32 worker);
+  void runTask(u32 worker);
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues;
+  std::vector<std::thread> workers;
+
+  // Guards sleeping and waking, not the deques
+  std::mutex state_lock;
+  std::condition_variable work_available;
+  std::condition_variable all_done; // also signals parallelFor() batches
+
+  std::atomic<u64> queued_count;  // submitted and not yet taken
+  std::atomic<u64> pending_count; // submitted and not yet finished
+  std::atomic<u32> next_queue;
+  bool stopping;
+};
+
+#endif // WORK_STEALING_POOL_H_
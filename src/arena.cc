@@ -0,0 +1,65 @@
+
+#include "arena.h"
+
+#include <cstdint>
+#include <new>
+
+Arena::Arena(size_t block_size) :
+    current_block(nullptr),
+    block_itr(nullptr),
+    block_end(nullptr),
+    block_size(block_size),
+    bytes_reserved(0) {
+
+}
+
+Arena::~Arena() {
+  release();
+}
+
+void*
+Arena::allocate(size_t size, size_t alignment) {
+  uintptr_t aligned_itr =
+    (reinterpret_cast<uintptr_t>(block_itr) + alignment - 1) & ~(alignment - 1);
+
+  if (block_itr == nullptr ||
+      aligned_itr + size > reinterpret_cast<uintptr_t>(block_end)) {
+    addBlock(size + alignment);
+    aligned_itr =
+      (reinterpret_cast<uintptr_t>(block_itr) + alignment - 1) & ~(alignment - 1);
+  }
+
+  block_itr = reinterpret_cast<u8*>(aligned_itr + size);
+  return reinterpret_cast<void*>(aligned_itr);
+}
+
+void
+Arena::release() {
+  while (current_block != nullptr) {
+    Block* previous = current_block->previous;
+    operator delete(current_block);
+    current_block = previous;
+  }
+  block_itr = block_end = nullptr;
+  bytes_reserved = 0;
+}
+
+u64
+Arena::bytesReserved() {
+  return bytes_reserved;
+}
+
+// Allocations larger than a block get a block of their own
+void
+Arena::addBlock(size_t min_size) {
+  const size_t new_block_size =
+    sizeof(Block) + (min_size > block_size ? min_size : block_size);
+
+  Block* new_block = static_cast<Block*>(operator new(new_block_size));
+  new_block->previous = current_block;
+
+  current_block = new_block;
+  block_itr = reinterpret_cast<u8*>(new_block + 1);
+  block_end = reinterpret_cast<u8*>(new_block) + new_block_size;
+  bytes_reserved += new_block_size;
+}
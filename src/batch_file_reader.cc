@@ -0,0 +1,102 @@
+
+#include "batch_file_reader.h"
+
+#include <memory>
+
+#include "file_mapped_io.h"
+
+BatchFileReader::BatchFileReader(WorkStealingPool& pool,
+                                 u32 small_file_read_limit,
+                                 u32 files_in_flight) :
+    pool(pool),
+    small_file_read_limit(small_file_read_limit),
+    files_in_flight(files_in_flight),
+    io_ring(nullptr),
+    files_handling(0) {
+  openIoRing();
+}
+
+BatchFileReader::~BatchFileReader() {
+  closeIoRing();
+}
+
+void
+BatchFileReader::readAll(const PathSource& next_path,
+                         const LoadedFileHandler& on_loaded) {
+  if (io_ring != nullptr) {
+    readAllWithIoRing(next_path, on_loaded);
+  } else {
+    readAllWithPool(next_path, on_loaded);
+  }
+  waitForHandlingBelow(1);
+}
+
+bool
+BatchFileReader::usesIoRing() {
+  return io_ring != nullptr;
+}
+
+void
+BatchFileReader::beginHandling() {
+  std::lock_guard<std::mutex> guard(handling_lock);
+  ++files_handling;
+}
+
+void
+BatchFileReader::endHandling() {
+  std::lock_guard<std::mutex> guard(handling_lock);
+  --files_handling;
+  handling_done.notify_all();
+}
+
+void
+BatchFileReader::waitForHandlingBelow(u32 limit) {
+  std::unique_lock<std::mutex> guard(handling_lock);
+  handling_done.wait(guard, [this, limit] { return files_handling < limit; });
+}
+
+void
+BatchFileReader::readAllWithPool(const PathSource& next_path,
+                                 const LoadedFileHandler& on_loaded) {
+  // Reused by every file a worker reads. Taken out for the duration of
+  // a file, which keeps it apart from tasks the worker runs while the
+  // handler waits on a parallelFor().
+  std::shared_ptr<std::vector<std::vector<char>>> worker_buffers =
+    std::make_shared<std::vector<std::vector<char>>>(pool.workerCount());
+
+  std::string file_path;
+  while (next_path(file_path)) {
+    waitForHandlingBelow(files_in_flight);
+    beginHandling();
+
+    pool.submit([this, file_path, worker_buffers, &on_loaded](u32 worker) {
+      loadFile(file_path, *worker_buffers, on_loaded, worker);
+      endHandling();
+    });
+  }
+}
+
+void
+BatchFileReader::loadFile(const std::string& file_path,
+                          std::vector<std::vector<char>>& worker_buffers,
+                          const LoadedFileHandler& on_loaded,
+                          u32 worker) {
+  FileMapper file_map(file_path.c_str(), MapAccess::READ_SEQUENTIAL);
+  const u64 file_size = file_map.getFileSize();
+
+  if (file_size != 0 && file_size <= small_file_read_limit) {
+    std::vector<char> buffer = std::move(worker_buffers[worker]);
+    buffer.resize(file_size);
+    if (file_map.read(0, buffer.data(), file_size)) {
+      on_loaded(file_path, buffer.data(), buffer.data() + file_size, worker);
+    }
+    worker_buffers[worker] = std::move(buffer);
+  } else if (file_size != 0) {
+    const char* file_begin =
+      static_cast<const char*>(file_map.map(0, file_size));
+    if (file_begin != nullptr) {
+      on_loaded(file_path, file_begin, file_begin + file_size, worker);
+      file_map.unmap(const_cast<char*>(file_begin), file_size);
+    }
+  }
+}
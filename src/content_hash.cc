@@ -0,0 +1,94 @@
+
+#include "content_hash.h"
+
+#include <cstring>
+
+internal_ const u64 prime_1 = 0x9e3779b185ebca87ULL;
+internal_ const u64 prime_2 = 0xc2b2ae3d27d4eb4fULL;
+internal_ const u64 prime_3 = 0x165667b19e3779f9ULL;
+internal_ const u64 prime_4 = 0x85ebca77c2b2ae63ULL;
+internal_ const u64 prime_5 = 0x27d4eb2f165667c5ULL;
+
+internal_ inline u64
+rotateLeft(u64 value, u32 bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+// Unaligned reads, memcpy compiles down to a single load
+internal_ inline u64
+read64(const u8* bytes) {
+  u64 value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+internal_ inline u32
+read32(const u8* bytes) {
+  u32 value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+internal_ inline u64
+mixLane(u64 accumulator, u64 input) {
+  accumulator += input * prime_2;
+  return rotateLeft(accumulator, 31) * prime_1;
+}
+
+internal_ inline u64
+mergeLane(u64 hash, u64 accumulator) {
+  hash ^= mixLane(0, accumulator);
+  return hash * prime_1 + prime_4;
+}
+
+u64
+hashContent(const void* data, u64 length, u64 seed) {
+  const u8* bytes = static_cast<const u8*>(data);
+  const u8* bytes_end = bytes + length;
+
+  u64 hash;
+  if (length >= 32) {
+    // 4 independent lanes of 8 bytes keep the multipliers busy
+    u64 lanes[4] = {
+      seed + prime_1 + prime_2,
+      seed + prime_2,
+      seed,
+      seed - prime_1
+    };
+    for (; bytes_end - bytes >= 32; bytes += 32) {
+      for (u32 lane = 0; lane < 4; ++lane) {
+        lanes[lane] = mixLane(lanes[lane], read64(bytes + 8 * lane));
+      }
+    }
+    hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) +
+           rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18);
+    for (u32 lane = 0; lane < 4; ++lane) {
+      hash = mergeLane(hash, lanes[lane]);
+    }
+  } else {
+    hash = seed + prime_5;
+  }
+  hash += length;
+
+  for (; bytes_end - bytes >= 8; bytes += 8) {
+    hash ^= mixLane(0, read64(bytes));
+    hash = rotateLeft(hash, 27) * prime_1 + prime_4;
+  }
+  if (bytes_end - bytes >= 4) {
+    hash ^= static_cast<u64>(read32(bytes)) * prime_1;
+    hash = rotateLeft(hash, 23) * prime_2 + prime_3;
+    bytes += 4;
+  }
+  for (; bytes != bytes_end; ++bytes) {
+    hash ^= *bytes * prime_5;
+    hash = rotateLeft(hash, 11) * prime_1;
+  }
+
+  // Avalanche, every input bit affects every output bit
+  hash ^= hash >> 33;
+  hash *= prime_2;
+  hash ^= hash >> 29;
+  hash *= prime_3;
+  hash ^= hash >> 32;
+  return hash;
+}
@@ -2,13 +2,34 @@
 // Print test for the lexer.
 
 #include <cstdio>
+#include <cstring>
 
 #include "lexer.h"
 #include "index_database.h"
 #include "file_mapped_io.h"
-
+#include "cpp_lexer.h"
+#include "batch_file_reader.h"
+
+// Tables cpp_lexer_table_gen generates from the rules below, for builds
+// which define CPP_LEXER_STATIC_TABLES. Regenerate them after changing
+// the rules; until then they are rejected as stale by their tag, a hash
+// of the rules, and the rules get compiled instead.
+#ifdef CPP_LEXER_STATIC_TABLES
+#include "cpp_lexer_tables.h"
+#endif
+
+// Immutable once built or loaded, shared by every lexing thread
 internal_ Lexer cpp_lexer;
-internal_ Token token;
+
+// Inputs at least this large are split across a pool's workers
+internal_ const size_t parallel_lexing_min_size = 1 << 22;
+
+// Without io_uring, files up to this size are read into a reused buffer
+// rather than mapped.
+// 64 KiB was among the fastest limits lexing /usr/include on a warm page
+// cache, and mapping loses further as workers multiply the shootdowns of
+// munmap. Retune with lexer_test -s.
+internal_ u32 small_file_read_limit = 1 << 16;
 
 enum {
   OCCUPIED = 0,
@@ -27,64 +48,357 @@ enum {
   END_OF_FILE = -52
 };
 
-void
-buildCppLexer() {
+// Keywords and native type spellings are lexed as NAME tokens and then
+// reclassified through a perfect hash table, which keeps their long
+// alternations out of the lexer's automaton. Multi word spellings such
+// as "unsigned long int" come out as one token per word.
+struct CppKeyword {
+  const char* spelling;
+  int token_id;
+};
 
-  // Example rules
-  // Note: C++11 raw string is useful for regex descriptions.
+internal_ constexpr CppKeyword cpp_keywords[] = {
+  {"for", KEYWORD}, {"while", KEYWORD}, {"if", KEYWORD},
+  {"else", KEYWORD}, {"switch", KEYWORD},
+
+  {"bool", NATIVE_BOOL_TYPES},
+
+  {"char", NATIVE_CHAR_TYPES}, {"wchar_t", NATIVE_CHAR_TYPES},
+  {"char16_t", NATIVE_CHAR_TYPES}, {"char32_t", NATIVE_CHAR_TYPES},
+
+  {"signed", NATIVE_INTEGER_TYPES}, {"unsigned", NATIVE_INTEGER_TYPES},
+  {"short", NATIVE_INTEGER_TYPES}, {"int", NATIVE_INTEGER_TYPES},
+  {"long", NATIVE_INTEGER_TYPES},
+
+  {"int8_t", NATIVE_INTEGER_TYPES}, {"uint8_t", NATIVE_INTEGER_TYPES},
+  {"int16_t", NATIVE_INTEGER_TYPES}, {"uint16_t", NATIVE_INTEGER_TYPES},
+  {"int32_t", NATIVE_INTEGER_TYPES}, {"uint32_t", NATIVE_INTEGER_TYPES},
+  {"int64_t", NATIVE_INTEGER_TYPES}, {"uint64_t", NATIVE_INTEGER_TYPES},
+
+  {"int_least8_t", NATIVE_INTEGER_TYPES},
+  {"uint_least8_t", NATIVE_INTEGER_TYPES},
+  {"int_least16_t", NATIVE_INTEGER_TYPES},
+  {"uint_least16_t", NATIVE_INTEGER_TYPES},
+  {"int_least32_t", NATIVE_INTEGER_TYPES},
+  {"uint_least32_t", NATIVE_INTEGER_TYPES},
+  {"int_least64_t", NATIVE_INTEGER_TYPES},
+  {"uint_least64_t", NATIVE_INTEGER_TYPES},
+
+  {"int_fast8_t", NATIVE_INTEGER_TYPES},
+  {"uint_fast8_t", NATIVE_INTEGER_TYPES},
+  {"int_fast16_t", NATIVE_INTEGER_TYPES},
+  {"uint_fast16_t", NATIVE_INTEGER_TYPES},
+  {"int_fast32_t", NATIVE_INTEGER_TYPES},
+  {"uint_fast32_t", NATIVE_INTEGER_TYPES},
+  {"int_fast64_t", NATIVE_INTEGER_TYPES},
+  {"uint_fast64_t", NATIVE_INTEGER_TYPES},
+
+  {"intmax_t", NATIVE_INTEGER_TYPES}, {"uintmax_t", NATIVE_INTEGER_TYPES},
+  {"intptr_t", NATIVE_INTEGER_TYPES}, {"uintptr_t", NATIVE_INTEGER_TYPES},
+
+  {"float", NATIVE_FLOAT_TYPES}, {"double", NATIVE_FLOAT_TYPES}
+};
 
-  // C-style comment
-  cpp_lexer.addRule(R"(/\*(\*[^/]|[^*])*\*/)", COMMENT);
+internal_ constexpr size_t keyword_count =
+  sizeof(cpp_keywords) / sizeof(*cpp_keywords);
+
+// FNV-1a with a seed picked so that the top 7 bits of the hash give
+// every keyword its own slot. The static_assert below rejects a keyword
+// list the seed no longer separates; pick a new seed when it fires.
+internal_ constexpr u32 keyword_hash_seed = 0x811c9e3f;
+internal_ constexpr u32 keyword_slot_bits = 7;
+
+internal_ constexpr u32
+keywordHash(const char* spelling, size_t length, u32 hash) {
+  return length == 0 ?
+    hash :
+    keywordHash(spelling + 1,
+                length - 1,
+                (hash ^ static_cast<u8>(*spelling)) * 16777619u);
+}
 
-  cpp_lexer.addRule(R"(for|while|if|else if|switch)", KEYWORD);
+internal_ constexpr size_t
+spellingLength(const char* spelling) {
+  return *spelling == '\0' ? 0 : 1 + spellingLength(spelling + 1);
+}
 
-  cpp_lexer.addRule(R"(#define)", PREPROCESSOR_DIRECTIVES);
-  
-  cpp_lexer.addRule(R"(bool)",
-                NATIVE_CHAR_TYPES);
+internal_ constexpr u32
+keywordSlot(const char* spelling, size_t length) {
+  return keywordHash(spelling, length, keyword_hash_seed) >>
+           (32 - keyword_slot_bits);
+}
 
-  cpp_lexer.addRule(R"(char|wchar_t|char16_t|char32_t|)"
-                R"(unsigned char|unsigned wchar_t|)"
-                R"(unsigned char16_t|unsigned char32_t)",
+internal_ constexpr u32
+keywordSlot(size_t keyword) {
+  return keywordSlot(cpp_keywords[keyword].spelling,
+                     spellingLength(cpp_keywords[keyword].spelling));
+}
+
+internal_ constexpr bool
+collidesWithLater(size_t keyword, size_t other) {
+  return other == keyword_count ?
+    false :
+    keywordSlot(keyword) == keywordSlot(other) ||
+      collidesWithLater(keyword, other + 1);
+}
+
+internal_ constexpr bool
+isPerfectHash(size_t keyword) {
+  return keyword == keyword_count ?
+    true :
+    !collidesWithLater(keyword, keyword + 1) && isPerfectHash(keyword + 1);
+}
 
-                NATIVE_CHAR_TYPES);
-  
-  cpp_lexer.addRule(R"((signed )?short|(signed )?short int|)"
-                R"(unsigned short|unsigned short int|)"
+static_assert(isPerfectHash(0), "keyword_hash_seed must give every keyword "
+                                "its own slot");
 
-                R"((signed )?int|)"
-                R"(unsigned int|)"
+struct KeywordSlot {
+  const char* spelling;
+  u32 length;
+  int token_id;
+};
 
-                R"((signed )?long|(signed )?long int|)"
-                R"(unsigned long|unsigned long int|)"
+struct KeywordTable {
+  KeywordTable() {
+    memset(slots, 0, sizeof(slots));
+    for (size_t keyword = 0; keyword < keyword_count; ++keyword) {
+      slots[keywordSlot(keyword)] = {
+        cpp_keywords[keyword].spelling,
+        static_cast<u32>(spellingLength(cpp_keywords[keyword].spelling)),
+        cpp_keywords[keyword].token_id
+      };
+    }
+  }
+
+  KeywordSlot slots[1 << keyword_slot_bits];
+};
 
-                R"((signed )?long long|(signed )?long long int|)"
-                R"(unsigned long long|unsigned long long int|)"
+internal_ const KeywordTable keyword_table;
 
-                R"((std::)?u?int(8|16|32|64)_t|)"
-                R"((std::)?u?int_(least|fast)?(8|16|32|64)_t|)"
-                R"((std::)?u?intmax_t|)"
-                R"((std::)?u?intptr_t)",
+struct CppRule {
+  const char* regex;
+  int token_id;
+};
 
-                NATIVE_INTEGER_TYPES);
+// Note: C++11 raw string is useful for regex descriptions.
+internal_ constexpr CppRule cpp_rules[] = {
+  // C-style comment
+  {R"(/\*(\*[^/]|[^*])*\*/)", COMMENT},
 
-  cpp_lexer.addRule(R"(float|(long )?double)", NATIVE_FLOAT_TYPES);
+  {R"(#define)", PREPROCESSOR_DIRECTIVES},
 
   // Floating point literals may be suffixed with f or l
-  cpp_lexer.addRule(R"([0-9]*\.[0-9]+[FfLl])", FLOAT_LITERAL);
+  {R"([0-9]*\.[0-9]+[FfLl])", FLOAT_LITERAL},
 
   // Integer literals may be suffixed with u and l or ll may follow
-  cpp_lexer.addRule(R"([0-9]+[Uu]?[Ll]{,2})", INTEGER_LITERAL);
+  {R"([0-9]+[Uu]?[Ll]{,2})", INTEGER_LITERAL},
+
+  // Keywords are told apart from other names by classifyName()
+  {R"([a-zA-Z_][a-zA-Z0-9_]*)", NAME},
 
-  cpp_lexer.addRule(R"([a-zA-Z_]+)", NAME);
+  {R"({|}|\(|\)|,|;|:{1,2}|\[|\]|<|>|\.)", DELIMITER},
 
-  cpp_lexer.addRule(R"({|}|\(|\)|,|;|:{1,2}|\[|\]|<|>|\.)", DELIMITER);
+  //{"\n|\r|\t| ", WHITE_SPACE_FOOD},
+};
+
+internal_ constexpr size_t rule_count = sizeof(cpp_rules) / sizeof(*cpp_rules);
+
+// FNV-1a of every rule's regex, its terminator and its token id, in order
+internal_ constexpr u32
+rulesetHash(size_t rule, u32 hash) {
+  return rule == rule_count ?
+    hash :
+    rulesetHash(rule + 1,
+                (keywordHash(cpp_rules[rule].regex,
+                             spellingLength(cpp_rules[rule].regex) + 1,
+                             hash) ^
+                 static_cast<u32>(cpp_rules[rule].token_id)) * 16777619u);
+}
 
-  //cpp_lexer.addRule("\n|\r|\t| ", WHITE_SPACE_FOOD);
+// Tags saved lexer tables, which are rejected once the rules change
+internal_ constexpr u32 cpp_lexer_ruleset_version =
+  rulesetHash(0, 2166136261u);
 
+// One hash probe plus a memcmp against the single candidate
+internal_ inline int
+classifyName(const char* name, u32 length) {
+  const KeywordSlot& slot = keyword_table.slots[keywordSlot(name, length)];
+  if (slot.length == length && memcmp(slot.spelling, name, length) == 0) {
+    return slot.token_id;
+  }
+  return NAME;
+}
+
+internal_ inline Token
+nextCppToken() {
+  Token next_token = cpp_lexer.nextToken();
+  if (next_token.id == NAME) {
+    next_token.id = classifyName(cpp_lexer.begin() + next_token.index,
+                                 next_token.length);
+  }
+  return next_token;
+}
+
+void
+buildCppLexer() {
+
+#ifdef CPP_LEXER_STATIC_TABLES
+  if (loadCppLexer(cpp_lexer_tables, sizeof(cpp_lexer_tables))) {
+    return;
+  }
+#endif
+
+  for (const CppRule& rule : cpp_rules) {
+    cpp_lexer.addRule(rule.regex, rule.token_id);
+  }
   cpp_lexer.build();
 }
 
+bool
+loadCppLexer(const void* tables_begin, u64 tables_size) {
+  return cpp_lexer.load(tables_begin, tables_size, cpp_lexer_ruleset_version);
+}
+
+void
+serializeCppLexer(std::vector<u8>& tables_out) {
+  cpp_lexer.serialize(tables_out, cpp_lexer_ruleset_version);
+}
+
+bool
+saveCppLexer(const char* file_path) {
+  return cpp_lexer.save(file_path, cpp_lexer_ruleset_version);
+}
+
+bool
+isCppName(int token_id) {
+  return token_id == NAME;
+}
+
+// Keywords among the tokens from first_token on, which begin at
+// input_begin + index - input_offset
+internal_ void
+classifyNames(const char* input_begin,
+              u64 input_offset,
+              TokenBuffer& tokens,
+              size_t first_token) {
+  for (size_t i = first_token; i < tokens.size(); ++i) {
+    if (tokens.id[i] == NAME) {
+      const char* name = input_begin + (tokens.index[i] - input_offset);
+      tokens.id[i] = classifyName(name, tokens.length[i]);
+    }
+  }
+}
+
+void
+tokenizeCpp(const char* input_begin,
+            const char* input_end,
+            TokenBuffer& tokens_out,
+            WorkStealingPool* pool) {
+  const size_t first_token = tokens_out.size();
+  if (pool != nullptr &&
+      static_cast<size_t>(input_end - input_begin) >= parallel_lexing_min_size) {
+    cpp_lexer.tokenizeParallel(input_begin, input_end, tokens_out, *pool);
+  } else {
+    cpp_lexer.tokenize(input_begin, input_end, tokens_out);
+  }
+
+  classifyNames(input_begin, 0, tokens_out, first_token);
+}
+
+bool
+tokenizeCppStream(FILE* input,
+                  const TokenizedStreamHandler& handler,
+                  size_t chunk_size) {
+  StreamingLexer stream_lexer(cpp_lexer);
+  std::vector<char> chunk(chunk_size);
+  TokenBuffer tokens;
+
+  for (;;) {
+    const size_t read_size = fread(chunk.data(), 1, chunk_size, input);
+    tokens.clear();
+    if (read_size != 0) {
+      stream_lexer.feed(chunk.data(), chunk.data() + read_size, tokens);
+    } else {
+      stream_lexer.finish(tokens);
+    }
+    classifyNames(stream_lexer.buffer(), stream_lexer.bufferOffset(),
+                  tokens, 0);
+    if (tokens.size() != 0) {
+      handler(stream_lexer.buffer(), stream_lexer.bufferOffset(), tokens);
+    }
+    if (read_size == 0) {
+      return ferror(input) == 0;
+    }
+  }
+}
+
+// Lexes the files a BatchFileReader reads on the pool's workers. Each
+// worker's token buffer is taken out for the duration of a file, which
+// keeps it apart from tasks the worker runs while helping a parallel split.
+internal_ void
+tokenizeCppPaths(const PathSource& next_path,
+                 WorkStealingPool& pool,
+                 const TokenizedFileHandler& handler) {
+  std::vector<TokenBuffer> worker_tokens(pool.workerCount());
+  BatchFileReader reader(pool, small_file_read_limit);
+
+  reader.readAll(next_path, [&](const std::string& file_path,
+                                const char* file_begin,
+                                const char* file_end,
+                                u32 worker) {
+    TokenBuffer tokens = std::move(worker_tokens[worker]);
+    tokens.clear();
+    tokenizeCpp(file_begin, file_end, tokens, &pool);
+    handler(file_path, file_begin, file_end, tokens, worker);
+    worker_tokens[worker] = std::move(tokens);
+  });
+}
+
+void
+setSmallFileReadLimit(u32 max_file_size) {
+  small_file_read_limit = max_file_size;
+}
+
+void
+tokenizeCppFiles(const std::vector<std::string>& file_paths,
+                 WorkStealingPool& pool,
+                 const TokenizedFileHandler& handler) {
+  size_t next_file = 0;
+  tokenizeCppPaths([&file_paths, &next_file](std::string& path_out) {
+    if (next_file == file_paths.size()) {
+      return false;
+    }
+    path_out = file_paths[next_file++];
+    return true;
+  }, pool, handler);
+}
+
+void
+tokenizeCppSourceTree(const std::string& root_path,
+                      const CrawlOptions& options,
+                      WorkStealingPool& discovery_pool,
+                      WorkStealingPool& lexing_pool,
+                      const TokenizedFileHandler& handler) {
+  BoundedQueue<CrawledFileBatch> batches(4 * lexing_pool.workerCount());
+  FileCrawler crawler(options, discovery_pool, batches);
+  crawler.crawl(root_path);
+
+  // Batches are read from as they arrive, overlapping discovery with
+  // reading and lexing
+  CrawledFileBatch batch;
+  size_t next_file = 0;
+  tokenizeCppPaths([&batches, &batch, &next_file](std::string& path_out) {
+    while (next_file == batch.size()) {
+      if (!batches.pop(batch)) {
+        return false;
+      }
+      next_file = 0;
+    }
+    path_out = std::move(batch[next_file++].path);
+    return true;
+  }, lexing_pool, handler);
+}
+
 void
 feedLexer(const char* file_begin, const char* file_end) {
   cpp_lexer.setStream(file_begin, file_end);
@@ -98,7 +412,7 @@ lexerTestPrintAllTokens() {
 
   for (;;) {
 
-    token = cpp_lexer.nextToken();
+    token = nextCppToken();
     if (token.id == END_OF_FILE) {
       std::cout << "EOF reached" << std::endl;
       break;
@@ -106,12 +420,15 @@ lexerTestPrintAllTokens() {
 
     count++;
 
+    u32 line, column;
+    cpp_lexer.position(token, line, column);
+
     std::cout << "Token found."                       << '\n';
     std::cout << "Index:\t"     << token.index        << '\n';
     std::cout << "Length:\t"    << token.length       << '\n';
     std::cout << "Id:\t"        << token.id           << '\n';
-    std::cout << "Line:\t"      << token.line_count   << '\n';
-    std::cout << "Column:\t"    << token.column_count << std::endl;
+    std::cout << "Line:\t"      << line               << '\n';
+    std::cout << "Column:\t"    << column             << std::endl;
     printf("Contents:\n%.*s\n\n",
            token.length,
            cpp_lexer.begin() + token.index);
@@ -123,12 +440,12 @@ lexerTestPrintAllTokens() {
 
 // Top-down recursive parsing helper calls to find functions
 internal_ void
-inFunctionScope() {
+inFunctionScope(Token& token) {
 
   int bracket_depth = 1;
 
   while (bracket_depth != 0) {
-    token = cpp_lexer.nextToken();
+    token = nextCppToken();
     switch (*(cpp_lexer.begin() + token.index)) {
       case '{': {
         ++bracket_depth;
@@ -141,14 +458,15 @@ inFunctionScope() {
       default:
         if (token.id == NAME) {
 
-          int line = token.line_count;
+          u32 line, column;
+          cpp_lexer.position(token, line, column);
           const char* func_begin = cpp_lexer.begin() + token.index;
 
-          token = cpp_lexer.nextToken();
+          token = nextCppToken();
           if (*(cpp_lexer.begin() + token.index) == '(') {
 
             for (;;) {
-              token = cpp_lexer.nextToken();
+              token = nextCppToken();
 
               if (*(cpp_lexer.begin() + token.index) == ')') {
 
@@ -178,12 +496,15 @@ inFunctionScope() {
 void
 lexerTestPrintAllFunctionsCalledInFunctions() {
 
+  Token token;
+  token.id = OCCUPIED;
+
   while (token.id != END_OF_FILE) {
-    token = cpp_lexer.nextToken();
+    token = nextCppToken();
 
     if (token.id == DELIMITER &&
         *(cpp_lexer.begin() + token.index) == '{') {
-      inFunctionScope();
+      inFunctionScope(token);
     }
   }
   std::cout << "EOF reached." << std::endl;
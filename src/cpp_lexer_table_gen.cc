@@ -0,0 +1,61 @@
+
+// Build time generator for the static cpp lexer tables.
+// Compiles the cpp lexing ruleset and writes its tables as a C++ header,
+// so builds defining CPP_LEXER_STATIC_TABLES lex with zero construction cost.
+// The generator itself must be built without CPP_LEXER_STATIC_TABLES.
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "types.h"
+#include "cpp_lexer.h"
+
+// args[1]: path of the header to be written, e.g. include/cpp_lexer_tables.h
+int main(int argc, char* args[]) {
+
+  if (argc != 2) {
+    puts("Expected one argument : path of the header to be written");
+    exit(EXIT_FAILURE);
+  }
+
+  buildCppLexer();
+
+  std::vector<u8> tables;
+  serializeCppLexer(tables);
+
+  FILE* header = fopen(args[1], "w");
+  if (header == nullptr) {
+    puts("Opening header for writing failed");
+    exit(EXIT_FAILURE);
+  }
+
+  fputs("\n"
+        "// Generated by cpp_lexer_table_gen from the rules in cpp_lexer.cc.\n"
+        "// Do not edit, regenerate after changing the rules instead.\n"
+        "\n"
+        "#ifndef CPP_LEXER_TABLES_H_\n"
+        "#define CPP_LEXER_TABLES_H_\n"
+        "\n"
+        "#include \"types.h\"\n"
+        "\n"
+        "alignas(8) internal_ const u8 cpp_lexer_tables[] = {",
+        header);
+
+  for (size_t i = 0; i < tables.size(); ++i) {
+    fputs(i % 16 == 0 ? "\n  " : " ", header);
+    fprintf(header, "0x%02x,", tables[i]);
+  }
+
+  fputs("\n"
+        "};\n"
+        "\n"
+        "#endif // CPP_LEXER_TABLES_H_\n",
+        header);
+
+  if (fclose(header) != 0) {
+    puts("Writing header failed");
+    exit(EXIT_FAILURE);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+
+#include "file_crawler.h"
+
+#include "directory_listing.h"
+
+CrawlOptions::CrawlOptions() :
+    extensions({".c", ".cc", ".cpp", ".cxx",
+                ".h", ".hh", ".hpp", ".hxx", ".inl"}),
+    ignore_patterns({".git", ".hg", ".svn"}),
+    batch_size(64) {
+
+}
+
+bool
+matchesPattern(const char* pattern, const char* name) {
+  // Backtracks to the most recent '*' only, which suffices for globs
+  const char* star = nullptr;
+  const char* star_name = nullptr;
+
+  while (*name != '\0') {
+    if (*pattern == '*') {
+      star = pattern++;
+      star_name = name;
+    } else if (*pattern == '?' || *pattern == *name) {
+      ++pattern;
+      ++name;
+    } else if (star != nullptr) {
+      pattern = star + 1;
+      name = ++star_name;
+    } else {
+      return false;
+    }
+  }
+  while (*pattern == '*') {
+    ++pattern;
+  }
+  return *pattern == '\0';
+}
+
+FileCrawler::FileCrawler(const CrawlOptions& options,
+                         WorkStealingPool& pool,
+                         BoundedQueue<CrawledFileBatch>& batches_out) :
+    options(options),
+    pool(pool),
+    batches_out(batches_out),
+    worker_batches(pool.workerCount()),
+    directories_pending(0),
+    files_found(0) {
+
+}
+
+void
+FileCrawler::crawl(const std::string& root_path) {
+  directories_pending.fetch_add(1);
+  pool.submit([this, root_path](u32 worker) {
+    crawlDirectory(root_path, worker);
+  });
+}
+
+u64
+FileCrawler::filesFound() {
+  return files_found.load();
+}
+
+void
+FileCrawler::crawlDirectory(const std::string& directory_path, u32 worker) {
+  std::vector<DirectoryEntry> entries;
+  listDirectory(directory_path, entries);
+
+  for (DirectoryEntry& entry : entries) {
+    if (isIgnored(entry.name)) {
+      continue;
+    }
+    std::string entry_path = directory_path;
+    entry_path += directory_separator;
+    entry_path += entry.name;
+
+    if (entry.is_directory) {
+      // Lands in this worker's deque, idle workers steal subtrees
+      directories_pending.fetch_add(1);
+      pool.submit([this, entry_path](u32 worker) {
+        crawlDirectory(entry_path, worker);
+      });
+    } else if (entry.is_regular_file && hasWantedExtension(entry.name)) {
+      addFile({std::move(entry_path), entry.size, entry.modification_time},
+              worker);
+    }
+  }
+
+  finishDirectory();
+}
+
+void
+FileCrawler::addFile(CrawledFile file, u32 worker) {
+  files_found.fetch_add(1);
+
+  CrawledFileBatch& batch = worker_batches[worker];
+  batch.push_back(std::move(file));
+  if (batch.size() >= options.batch_size) {
+    batches_out.push(std::move(batch));
+    batch = CrawledFileBatch();
+  }
+}
+
+void
+FileCrawler::finishDirectory() {
+  if (directories_pending.fetch_sub(1) != 1) {
+    return;
+  }
+
+  // Every other directory task is done, so no batch is being filled
+  for (CrawledFileBatch& batch : worker_batches) {
+    if (!batch.empty()) {
+      batches_out.push(std::move(batch));
+      batch = CrawledFileBatch();
+    }
+  }
+  batches_out.close();
+}
+
+bool
+FileCrawler::isIgnored(const std::string& name) {
+  for (const std::string& pattern : options.ignore_patterns) {
+    if (matchesPattern(pattern.c_str(), name.c_str())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool
+FileCrawler::hasWantedExtension(const std::string& name) {
+  if (options.extensions.empty()) {
+    return true;
+  }
+  for (const std::string& extension : options.extensions) {
+    if (name.size() >= extension.size() &&
+        name.compare(name.size() - extension.size(),
+                     extension.size(),
+                     extension) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
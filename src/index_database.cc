@@ -1,7 +1,457 @@
 
 #include "index_database.h"
 
-DataBase::DataBase(const char* file_path) : file_mapper(file_path) {
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <unordered_map>
+
+#include "content_hash.h"
+#include "cpp_lexer.h"
+#include "directory_listing.h"
+#include "lexer.h"
+#include "postings.h"
+#include "regex.h"
+#include "trigram_index.h"
+#include "utils.h"
+
+const u32 IndexHeader::MAGIC;
+const u32 IndexHeader::VERSION;
+const u32 IndexHeader::SECTION_ALIGNMENT;
+
+// A section's contents while the index is being built
+struct SectionData {
+  SectionKind kind;
+  std::vector<u8> bytes;
+};
+
+// What build() gathers about a file on the worker which lexed it, or
+// partialBuild() reads back from the index for a file which is unchanged
+struct IndexedFile {
+  IndexedFile() :
+      indexed(false),
+      reused(false),
+      size(0),
+      modification_time(0),
+      content_hash(0) {
+
+  }
+
+  bool indexed;
+  bool reused; // read back by partialBuild()
+  u64 size;
+  u64 modification_time;
+  u64 content_hash;
+
+  // Names of the file, interned into the database's string pool in file
+  // order once every file is lexed, which keeps string ids independent
+  // of the order the workers finish files in
+  StringPool names;
+
+  // Occurrences of the names in file order, by their id in names until
+  // remapped to string ids. Files reused refer to the string ids of the
+  // index being updated instead, grouped by string id, which keeps the
+  // occurrences of each name in file order all the same.
+  std::vector<u32> name_ids;
+  std::vector<u32> name_offsets;
+
+  // Of a file reused, the string ids it refers to in order of their
+  // first occurrence, the order its names would be interned in
+  std::vector<u32> reused_ids;
+
+  // Distinct trigrams of the file's contents
+  std::vector<u32> trigrams;
+};
+
+internal_ void
+appendBytes(std::vector<u8>& bytes_out, const void* data, size_t size) {
+  const u8* data_begin = static_cast<const u8*>(data);
+  bytes_out.insert(bytes_out.end(), data_begin, data_begin + size);
+}
+
+template <typename T>
+internal_ void
+appendValue(std::vector<u8>& bytes_out, const T& value) {
+  appendBytes(bytes_out, &value, sizeof(T));
+}
+
+internal_ u64
+alignUp(u64 offset, u64 alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+internal_ SectionData
+buildFileTable(const std::vector<std::string>& file_paths,
+               const std::vector<IndexedFile>& files) {
+  SectionData file_table = {SectionKind::FILE_TABLE, {}};
+  std::vector<u8>& bytes = file_table.bytes;
+
+  FileTableHeader table_header = {0, 0};
+  for (const IndexedFile& file : files) {
+    table_header.file_count += file.indexed ? 1 : 0;
+  }
+  appendValue(bytes, table_header);
+
+  u64 path_offset = sizeof(FileTableHeader) +
+                    table_header.file_count * sizeof(FileRecord);
+  for (size_t file = 0; file < files.size(); ++file) {
+    if (files[file].indexed) {
+      const FileRecord record = {
+        path_offset,
+        static_cast<u32>(file_paths[file].size()),
+        0,
+        files[file].size,
+        files[file].modification_time,
+        files[file].content_hash
+      };
+      appendValue(bytes, record);
+      path_offset += file_paths[file].size();
+    }
+  }
+  for (size_t file = 0; file < files.size(); ++file) {
+    if (files[file].indexed) {
+      appendBytes(bytes, file_paths[file].data(), file_paths[file].size());
+    }
+  }
+  return file_table;
+}
+
+// Inverts the occurrences of every indexed file into per symbol postings,
+// listed in file and offset order by walking the files in order
+internal_ void
+buildPostings(const std::vector<IndexedFile>& files,
+              u32 symbol_count,
+              SectionData& symbol_table_out,
+              SectionData& postings_out) {
+  // Symbol id's occurrences fill [symbol_begins[id] ; symbol_begins[id + 1][
+  std::vector<u64> symbol_begins(u64(symbol_count) + 1, 0);
+  for (const IndexedFile& file : files) {
+    for (u32 name_id : file.name_ids) {
+      ++symbol_begins[name_id + 1];
+    }
+  }
+  for (u32 symbol = 0; symbol < symbol_count; ++symbol) {
+    symbol_begins[symbol + 1] += symbol_begins[symbol];
+  }
+
+  std::vector<Occurrence> occurrences(symbol_begins.back());
+  std::vector<u64> symbol_ends(symbol_begins.begin(), symbol_begins.end() - 1);
+  u32 file_id = 0;
+  for (const IndexedFile& file : files) {
+    if (!file.indexed) {
+      continue;
+    }
+    for (size_t i = 0; i < file.name_ids.size(); ++i) {
+      occurrences[symbol_ends[file.name_ids[i]]++] =
+        {file_id, file.name_offsets[i]};
+    }
+    ++file_id;
+  }
+
+  appendValue(symbol_table_out.bytes, SymbolTableHeader{symbol_count, 0});
+  for (u32 symbol = 0; symbol < symbol_count; ++symbol) {
+    SymbolEntry entry;
+    encodePostings(occurrences.data() + symbol_begins[symbol],
+                   static_cast<u32>(symbol_begins[symbol + 1] -
+                                    symbol_begins[symbol]),
+                   postings_out.bytes,
+                   entry);
+    appendValue(symbol_table_out.bytes, entry);
+  }
+}
+
+// Inverts the trigrams of every id into a trigram section, listing the
+// ids of each trigram in ascending order by walking the ids in order.
+// The trigrams occurring are marked in a bitmap and counted by their
+// rank among those, so memory follows the trigrams present rather than
+// all 1 << 24 possible ones.
+internal_ void
+buildTrigramTable(const std::vector<std::vector<u32>>& id_trigrams,
+                  SectionData& section_out) {
+  std::vector<u64> present(1 << 18, 0);
+  for (const std::vector<u32>& trigrams : id_trigrams) {
+    for (u32 trigram : trigrams) {
+      present[trigram >> 6] |= u64(1) << (trigram & 63);
+    }
+  }
+  // Rank of a trigram: the number of trigrams present below it
+  std::vector<u32> word_ranks(present.size());
+  TrigramTableHeader table_header = {0, 0};
+  for (size_t word = 0; word < present.size(); ++word) {
+    word_ranks[word] = table_header.trigram_count;
+    table_header.trigram_count += countSetBits(present[word]);
+  }
+  auto rank = [&](u32 trigram) {
+    const u64 bits_below = (u64(1) << (trigram & 63)) - 1;
+    return word_ranks[trigram >> 6] +
+           countSetBits(present[trigram >> 6] & bits_below);
+  };
+
+  // The ids of the trigram of rank r fill [rank_begins[r] ;
+  // rank_begins[r + 1][
+  std::vector<u64> rank_begins(u64(table_header.trigram_count) + 1, 0);
+  for (const std::vector<u32>& trigrams : id_trigrams) {
+    for (u32 trigram : trigrams) {
+      ++rank_begins[rank(trigram) + 1];
+    }
+  }
+  for (u32 r = 0; r < table_header.trigram_count; ++r) {
+    rank_begins[r + 1] += rank_begins[r];
+  }
+
+  std::vector<u32> ids(rank_begins.back());
+  std::vector<u64> rank_ends(rank_begins.begin(), rank_begins.end() - 1);
+  for (size_t id = 0; id < id_trigrams.size(); ++id) {
+    for (u32 trigram : id_trigrams[id]) {
+      ids[rank_ends[rank(trigram)]++] = static_cast<u32>(id);
+    }
+  }
+  rank_ends = std::vector<u64>();
+
+  std::vector<u8>& bytes = section_out.bytes;
+  appendValue(bytes, table_header);
+  const size_t entries_begin = bytes.size();
+  bytes.resize(entries_begin +
+               table_header.trigram_count * sizeof(TrigramEntry));
+  size_t entry_offset = entries_begin;
+  u32 r = 0;
+  for (size_t word = 0; word < present.size(); ++word) {
+    for (u64 bits = present[word]; bits != 0; bits &= bits - 1, ++r) {
+      const u64 id_count = rank_begins[r + 1] - rank_begins[r];
+      u32* trigram_ids = ids.data() + rank_begins[r];
+      deltaEncode(trigram_ids, static_cast<u32>(id_count));
+
+      TrigramEntry entry;
+      entry.trigram = static_cast<u32>(word * 64 + countTrailingZeros(bits));
+      entry.id_count = static_cast<u32>(id_count);
+      entry.ids_offset = bytes.size();
+      entry.ids_size = static_cast<u32>(
+        encodeValues(trigram_ids, entry.id_count, bytes));
+      entry.reserved = 0;
+      memcpy(bytes.data() + entry_offset, &entry, sizeof(TrigramEntry));
+      entry_offset += sizeof(TrigramEntry);
+    }
+  }
+}
+
+// Writes the header, the section table and the sections in this order
+internal_ bool
+writeIndexFile(const char* file_path,
+               const std::vector<SectionData>& sections,
+               u64 build_time) {
+  IndexHeader header;
+  header.magic = IndexHeader::MAGIC;
+  header.version = IndexHeader::VERSION;
+  header.section_count = static_cast<u32>(sections.size());
+  header.section_alignment = IndexHeader::SECTION_ALIGNMENT;
+  header.section_table_offset = sizeof(IndexHeader);
+  header.build_time = build_time;
+
+  std::vector<SectionEntry> section_table;
+  u64 section_offset = header.section_table_offset +
+                       sections.size() * sizeof(SectionEntry);
+  for (const SectionData& section : sections) {
+    section_offset = alignUp(section_offset, header.section_alignment);
+    section_table.push_back({section.kind, 0, section_offset,
+                             section.bytes.size()});
+    section_offset += section.bytes.size();
+  }
+  header.file_size = section_offset;
+
+  FILE* index_file = fopen(file_path, "wb");
+  if (index_file == nullptr) {
+    std::cerr << "Opening index file for writing failed" << std::endl;
+    return false;
+  }
+  bool write_success =
+    fwrite(&header, sizeof(header), 1, index_file) == 1 &&
+    fwrite(section_table.data(), sizeof(SectionEntry),
+           section_table.size(), index_file) == section_table.size();
+
+  u64 written = header.section_table_offset +
+                section_table.size() * sizeof(SectionEntry);
+  const std::vector<u8> padding(IndexHeader::SECTION_ALIGNMENT, 0);
+  for (size_t section = 0; section < sections.size() && write_success;
+       ++section) {
+    const size_t padding_size =
+      static_cast<size_t>(section_table[section].offset - written);
+    const std::vector<u8>& bytes = sections[section].bytes;
+    write_success =
+      fwrite(padding.data(), 1, padding_size, index_file) == padding_size &&
+      fwrite(bytes.data(), 1, bytes.size(), index_file) == bytes.size();
+    written = section_table[section].offset + bytes.size();
+  }
+
+  if (fclose(index_file) != 0 || !write_success) {
+    std::cerr << "Writing index file failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Creates the file the index is built at and returns its modification
+// time, which stands for when the build began in the units and with the
+// granularity of file modification times. 0 if that fails, which takes
+// every file for modified since.
+internal_ u64
+markBuildTime(const std::string& built_path) {
+  FILE* built_file = fopen(built_path.c_str(), "wb");
+  if (built_file == nullptr) {
+    return 0;
+  }
+  fclose(built_file);
+  DirectoryEntry attributes;
+  return statFile(built_path, attributes) ? attributes.modification_time : 0;
+}
+
+// Paths in first occurrence order without repeats, path_ids_out maps
+// each to its position
+internal_ std::vector<std::string>
+uniquePaths(const std::vector<std::string>& file_paths,
+            std::unordered_map<std::string, u32>& path_ids_out) {
+  std::vector<std::string> unique_paths;
+  for (const std::string& path : file_paths) {
+    const u32 path_id = static_cast<u32>(unique_paths.size());
+    if (path_ids_out.emplace(path, path_id).second) {
+      unique_paths.push_back(path);
+    }
+  }
+  return unique_paths;
+}
+
+// Stats every file ahead of reading it. A file changing while it's being
+// indexed then keeps an older modification time than the contents it
+// gets next, which partialBuild() won't take for unchanged. Files which
+// can't be stat'ed are listed as neither a file nor a directory.
+internal_ std::vector<DirectoryEntry>
+statFiles(const std::vector<std::string>& file_paths, WorkStealingPool& pool) {
+  std::vector<DirectoryEntry> attributes(file_paths.size());
+  pool.parallelFor(file_paths.size(), [&](size_t file, u32) {
+    DirectoryEntry& file_attributes = attributes[file];
+    if (!statFile(file_paths[file], file_attributes)) {
+      file_attributes.is_directory = false;
+      file_attributes.is_regular_file = false;
+      file_attributes.size = 0;
+      file_attributes.modification_time = 0;
+    }
+  });
+  return attributes;
+}
+
+// Lexes the files across the pool's workers, gathering what the index
+// holds of each into files at their position in path_ids
+internal_ void
+lexFiles(const std::vector<std::string>& file_paths,
+         const std::unordered_map<std::string, u32>& path_ids,
+         WorkStealingPool& pool,
+         std::vector<IndexedFile>& files) {
+  // Trigram bitmaps reused by every file a worker indexes
+  std::vector<std::vector<u64>> worker_trigrams_seen(pool.workerCount());
+
+  tokenizeCppFiles(file_paths, pool, [&](const std::string& path,
+                                         const char* file_begin,
+                                         const char* file_end,
+                                         const TokenBuffer& tokens,
+                                         u32 worker) {
+    IndexedFile& file = files[path_ids.at(path)];
+    file.indexed = true;
+    file.size = static_cast<u64>(file_end - file_begin);
+    file.content_hash = hashContent(file_begin, file.size);
+
+    std::vector<u64> trigrams_seen = std::move(worker_trigrams_seen[worker]);
+    trigrams_seen.resize(1 << 18, 0);
+    collectTrigrams(file_begin, file_end, trigrams_seen, file.trigrams);
+    worker_trigrams_seen[worker] = std::move(trigrams_seen);
+
+    for (size_t token = 0; token < tokens.size(); ++token) {
+      // Postings store 32-bit offsets, names beyond 4 GiB go unrecorded
+      if (isCppName(tokens.id[token]) && tokens.index[token] <= ~u32(0)) {
+        file.name_ids.push_back(
+          file.names.intern(file_begin + tokens.index[token],
+                            tokens.length[token]));
+        file.name_offsets.push_back(static_cast<u32>(tokens.index[token]));
+      }
+    }
+  });
+}
+
+// Interns the names of the files into one string pool and writes the
+// index of the files at built_path. reused_strings is the string pool of
+// the index the reused files were read back from.
+internal_ bool
+buildIndexFile(const char* built_path,
+               const std::vector<std::string>& file_paths,
+               std::vector<IndexedFile>& files,
+               const StringPool& reused_strings,
+               u64 build_time) {
+  StringPool string_pool;
+  std::vector<u32> string_ids;
+  std::vector<u32> reused_string_ids(reused_strings.size());
+  for (IndexedFile& file : files) {
+    if (file.reused) {
+      for (u32 reused_id : file.reused_ids) {
+        reused_string_ids[reused_id] =
+          string_pool.intern(reused_strings.string(reused_id),
+                             reused_strings.length(reused_id));
+      }
+      for (u32& name_id : file.name_ids) {
+        name_id = reused_string_ids[name_id];
+      }
+      continue;
+    }
+    string_ids.resize(file.names.size());
+    for (u32 name = 0; name < file.names.size(); ++name) {
+      string_ids[name] = string_pool.intern(file.names.string(name),
+                                            file.names.length(name));
+    }
+    for (u32& name_id : file.name_ids) {
+      name_id = string_ids[name_id];
+    }
+    file.names = StringPool();
+  }
+
+  std::vector<SectionData> built_sections;
+  built_sections.push_back(buildFileTable(file_paths, files));
+  built_sections.push_back({SectionKind::STRING_POOL, {}});
+  string_pool.serialize(built_sections.back().bytes);
+  built_sections.push_back({SectionKind::SYMBOL_TABLE, {}});
+  built_sections.push_back({SectionKind::POSTINGS, {}});
+  buildPostings(files, string_pool.size(),
+                built_sections[2], built_sections[3]);
+
+  std::vector<std::vector<u32>> id_trigrams(string_pool.size());
+  std::vector<u64> trigrams_seen(1 << 18, 0);
+  for (u32 string_id = 0; string_id < string_pool.size(); ++string_id) {
+    const char* string = string_pool.string(string_id);
+    collectTrigrams(string, string + string_pool.length(string_id),
+                    trigrams_seen, id_trigrams[string_id]);
+  }
+  built_sections.push_back({SectionKind::NAME_TRIGRAMS, {}});
+  buildTrigramTable(id_trigrams, built_sections.back());
+
+  id_trigrams.clear();
+  for (IndexedFile& file : files) {
+    if (file.indexed) {
+      id_trigrams.push_back(std::move(file.trigrams));
+    }
+  }
+  built_sections.push_back({SectionKind::CONTENT_TRIGRAMS, {}});
+  buildTrigramTable(id_trigrams, built_sections.back());
+
+  if (!writeIndexFile(built_path, built_sections, build_time)) {
+    remove(built_path);
+    return false;
+  }
+  return true;
+}
+
+DataBase::DataBase(const char* file_path) :
+    file_path(file_path),
+    file_mapper(nullptr),
+    windows(nullptr),
+    loaded(false) {
   load();
 }
 
@@ -9,10 +459,813 @@ DataBase::~DataBase() {
   release();
 }
 
-void DataBase::load() {
-  file_begin = file_mapper.map(0, HEADER_LAST);
+bool
+DataBase::load() {
+  release();
+  // No index yet isn't an error, it's the first build
+  DirectoryEntry attributes;
+  if (!statFile(file_path, attributes)) {
+    return false;
+  }
+  file_mapper = new FileMapper(file_path.c_str(), MapAccess::READ_ONLY);
+  windows = new MappedWindows(*file_mapper);
+
+  const u64 file_size = windows->fileSize();
+  const u8* header_ptr = windows->access(0, sizeof(IndexHeader));
+  if (header_ptr == nullptr) {
+    release();
+    return false;
+  }
+  memcpy(&header, header_ptr, sizeof(IndexHeader));
+  if (header.magic != IndexHeader::MAGIC ||
+      header.version != IndexHeader::VERSION ||
+      header.file_size != file_size ||
+      header.section_table_offset > file_size ||
+      header.section_count > (file_size - header.section_table_offset) /
+                             sizeof(SectionEntry)) {
+    release();
+    return false;
+  }
+
+  const u64 table_size = header.section_count * sizeof(SectionEntry);
+  sections.resize(header.section_count);
+  if (!file_mapper->read(header.section_table_offset,
+                         sections.data(),
+                         table_size)) {
+    release();
+    return false;
+  }
+  for (const SectionEntry& section : sections) {
+    if (section.offset > file_size ||
+        section.size > file_size - section.offset) {
+      release();
+      return false;
+    }
+  }
+
+  loaded = true;
+  return true;
+}
+
+void
+DataBase::release() {
+  delete windows;
+  delete file_mapper;
+  windows = nullptr;
+  file_mapper = nullptr;
+  sections.clear();
+  loaded = false;
+}
+
+bool
+DataBase::isLoaded() {
+  return loaded;
+}
+
+bool
+DataBase::build(const std::vector<std::string>& file_paths,
+                WorkStealingPool& pool) {
+  // Each file is indexed once, under the id of its first occurrence
+  std::unordered_map<std::string, u32> path_ids;
+  const std::vector<std::string> unique_paths =
+    uniquePaths(file_paths, path_ids);
+
+  // Written aside and moved over the old index once complete, which
+  // keeps the old index intact if writing fails
+  const std::string built_path = file_path + ".tmp";
+  const u64 build_time = markBuildTime(built_path);
+
+  const std::vector<DirectoryEntry> attributes =
+    statFiles(unique_paths, pool);
+  std::vector<IndexedFile> files(unique_paths.size());
+  for (size_t file = 0; file < files.size(); ++file) {
+    files[file].modification_time = attributes[file].modification_time;
+  }
+  lexFiles(unique_paths, path_ids, pool, files);
+
+  return buildIndexFile(built_path.c_str(), unique_paths, files,
+                        StringPool(), build_time) &&
+         replaceIndexFile(built_path);
+}
+
+bool
+DataBase::partialBuild(const std::vector<std::string>& file_paths,
+                       WorkStealingPool& pool) {
+  if (!loaded) {
+    return build(file_paths, pool);
+  }
+
+  std::unordered_map<std::string, u32> path_ids;
+  const std::vector<std::string> unique_paths =
+    uniquePaths(file_paths, path_ids);
+  const std::string built_path = file_path + ".tmp";
+  const u64 build_time = markBuildTime(built_path);
+  const std::vector<DirectoryEntry> attributes =
+    statFiles(unique_paths, pool);
+  std::vector<IndexedFile> files(unique_paths.size());
+  for (size_t file = 0; file < files.size(); ++file) {
+    files[file].modification_time = attributes[file].modification_time;
+  }
+
+  // Files still of their indexed size keep their index if their
+  // modification time is the same and older than the index, or else if
+  // the hash of their contents is the same
+  const u32 indexed_count = fileCount();
+  std::vector<u32> file_slots(indexed_count, ~u32(0));
+  std::vector<u32> touched_files;
+  std::vector<u32> touched_path_ids;
+  for (u32 file_id = 0; file_id < indexed_count; ++file_id) {
+    FileRecord record;
+    if (!readFileRecord(file_id, record)) {
+      return build(file_paths, pool);
+    }
+    const auto path_id = path_ids.find(filePath(file_id));
+    if (path_id == path_ids.end() ||
+        !attributes[path_id->second].is_regular_file ||
+        attributes[path_id->second].size != record.size) {
+      continue;
+    }
+    IndexedFile& file = files[path_id->second];
+    file.size = record.size;
+    file.content_hash = record.content_hash;
+    if (attributes[path_id->second].modification_time ==
+          record.modification_time &&
+        record.modification_time < header.build_time) {
+      file_slots[file_id] = path_id->second;
+    } else {
+      touched_files.push_back(file_id);
+      touched_path_ids.push_back(path_id->second);
+    }
+  }
+
+  std::vector<u32> touched_slots(touched_files.size(), ~u32(0));
+  pool.parallelFor(touched_files.size(), [&](size_t touched, u32) {
+    const u32 path_id = touched_path_ids[touched];
+    FileMapper file_map(unique_paths[path_id].c_str(),
+                        MapAccess::READ_SEQUENTIAL);
+    const u64 file_size = file_map.getFileSize();
+    if (file_size != files[path_id].size || file_size == 0) {
+      return;
+    }
+    const char* file_begin =
+      static_cast<const char*>(file_map.map(0, file_size));
+    if (file_begin != nullptr) {
+      if (hashContent(file_begin, file_size) == files[path_id].content_hash) {
+        touched_slots[touched] = path_id;
+      }
+      file_map.unmap(const_cast<char*>(file_begin), file_size);
+    }
+  });
+  for (size_t touched = 0; touched < touched_files.size(); ++touched) {
+    file_slots[touched_files[touched]] = touched_slots[touched];
+  }
+
+  // The index stays as it is if it holds the files to index in the same
+  // order, the other paths being ones build() would skip
+  bool same_files = true;
+  for (u32 file_id = 0; file_id < indexed_count; ++file_id) {
+    if (file_slots[file_id] == ~u32(0) ||
+        (file_id != 0 && file_slots[file_id] <= file_slots[file_id - 1])) {
+      same_files = false;
+      break;
+    }
+  }
+  u32 indexable_count = 0;
+  for (const DirectoryEntry& file_attributes : attributes) {
+    if (file_attributes.is_regular_file && file_attributes.size != 0) {
+      ++indexable_count;
+    }
+  }
+  if (same_files && indexable_count == indexed_count) {
+    remove(built_path.c_str());
+    std::vector<u64> modification_times(indexed_count);
+    for (u32 file_id = 0; file_id < indexed_count; ++file_id) {
+      modification_times[file_id] =
+        attributes[file_slots[file_id]].modification_time;
+    }
+    return updateFileTimes(modification_times, build_time);
+  }
+
+  // The files kept are read back from this index rather than lexed, a
+  // malformed index is rebuilt whole instead
+  std::vector<std::vector<u32>> file_name_ids(files.size());
+  std::vector<std::vector<u32>> file_name_offsets(files.size());
+  std::vector<std::vector<u32>> file_trigrams(files.size());
+  StringPool reused_strings;
+  if (!readFileNames(file_slots, file_name_ids, file_name_offsets) ||
+      !readFileTrigrams(file_slots, file_trigrams) ||
+      !readStringPool(reused_strings)) {
+    return build(file_paths, pool);
+  }
+
+  std::vector<u8> reused(files.size(), 0);
+  for (u32 file_slot : file_slots) {
+    if (file_slot != ~u32(0)) {
+      reused[file_slot] = 1;
+    }
+  }
+  pool.parallelFor(files.size(), [&](size_t slot, u32) {
+    if (reused[slot] == 0) {
+      return;
+    }
+    IndexedFile& file = files[slot];
+    file.indexed = true;
+    file.reused = true;
+    file.trigrams = std::move(file_trigrams[slot]);
+    file.name_ids = std::move(file_name_ids[slot]);
+    file.name_offsets = std::move(file_name_offsets[slot]);
+
+    // The first occurrence of each name leads its group, as
+    // offset << 32 | string id
+    std::vector<u64> first_names;
+    for (size_t name = 0; name < file.name_ids.size(); ++name) {
+      if (name == 0 || file.name_ids[name] != file.name_ids[name - 1]) {
+        first_names.push_back(u64(file.name_offsets[name]) << 32 |
+                              file.name_ids[name]);
+      }
+    }
+    std::sort(first_names.begin(), first_names.end());
+    for (u64 first_name : first_names) {
+      file.reused_ids.push_back(static_cast<u32>(first_name));
+    }
+  });
+
+  // New files and files whose contents changed are lexed again
+  std::vector<std::string> changed_paths;
+  for (size_t file = 0; file < files.size(); ++file) {
+    if (reused[file] == 0) {
+      files[file].size = 0;
+      files[file].content_hash = 0;
+      changed_paths.push_back(unique_paths[file]);
+    }
+  }
+  lexFiles(changed_paths, path_ids, pool, files);
+
+  return buildIndexFile(built_path.c_str(), unique_paths, files,
+                        reused_strings, build_time) &&
+         replaceIndexFile(built_path);
+}
+u32
+DataBase::fileCount() {
+  const SectionEntry* file_table = findSection(SectionKind::FILE_TABLE);
+  FileTableHeader table_header;
+  if (file_table == nullptr ||
+      !readSectionValue(*file_table, 0, table_header)) {
+    return 0;
+  }
+  return table_header.file_count;
+}
+
+std::string
+DataBase::filePath(u32 file_id) {
+  const SectionEntry* file_table = findSection(SectionKind::FILE_TABLE);
+  FileRecord record;
+  if (!readFileRecord(file_id, record)) {
+    return std::string();
+  }
+  std::vector<u8> spill;
+  const u8* path = sectionBytes(*file_table, record.path_offset,
+                                record.path_length, spill);
+  if (path == nullptr) {
+    return std::string();
+  }
+  return std::string(reinterpret_cast<const char*>(path), record.path_length);
+}
+
+u64
+DataBase::fileSize(u32 file_id) {
+  FileRecord record;
+  return readFileRecord(file_id, record) ? record.size : 0;
+}
+
+bool
+DataBase::readFileRecord(u32 file_id, FileRecord& record_out) {
+  const SectionEntry* file_table = findSection(SectionKind::FILE_TABLE);
+  return file_table != nullptr &&
+         readSectionValue(*file_table,
+                          sizeof(FileTableHeader) +
+                            u64(file_id) * sizeof(FileRecord),
+                          record_out);
+}
+
+bool
+DataBase::readSection(const SectionEntry& section,
+                      std::vector<u8>& bytes_out) {
+  bytes_out.resize(section.size);
+  return loaded &&
+         file_mapper->read(section.offset, bytes_out.data(), section.size);
+}
+
+// Inverts the postings of every symbol back into the names of the files
+bool
+DataBase::readFileNames(const std::vector<u32>& file_slots,
+                        std::vector<std::vector<u32>>& name_ids_out,
+                        std::vector<std::vector<u32>>& name_offsets_out) {
+  const SectionEntry* symbol_section =
+    findSection(SectionKind::SYMBOL_TABLE);
+  const SectionEntry* postings_section = findSection(SectionKind::POSTINGS);
+  std::vector<u8> symbol_table;
+  std::vector<u8> postings;
+  if (symbol_section == nullptr || postings_section == nullptr ||
+      !readSection(*symbol_section, symbol_table) ||
+      !readSection(*postings_section, postings) ||
+      symbol_table.size() < sizeof(SymbolTableHeader)) {
+    return false;
+  }
+  SymbolTableHeader table_header;
+  memcpy(&table_header, symbol_table.data(), sizeof(SymbolTableHeader));
+  // Symbols are numbered by string id
+  if (table_header.symbol_count >
+        (symbol_table.size() - sizeof(SymbolTableHeader)) /
+        sizeof(SymbolEntry) ||
+      table_header.symbol_count > stringCount()) {
+    return false;
+  }
+
+  std::vector<Occurrence> occurrences;
+  for (u32 symbol = 0; symbol < table_header.symbol_count; ++symbol) {
+    SymbolEntry entry;
+    memcpy(&entry,
+           symbol_table.data() + sizeof(SymbolTableHeader) +
+             u64(symbol) * sizeof(SymbolEntry),
+           sizeof(SymbolEntry));
+    occurrences.clear();
+    if (entry.postings_offset > postings.size() ||
+        entry.postings_size > postings.size() - entry.postings_offset ||
+        !decodePostings(entry, postings.data() + entry.postings_offset,
+                        occurrences)) {
+      return false;
+    }
+    for (const Occurrence& occurrence : occurrences) {
+      if (occurrence.file_id < file_slots.size() &&
+          file_slots[occurrence.file_id] != ~u32(0)) {
+        const u32 file_slot = file_slots[occurrence.file_id];
+        name_ids_out[file_slot].push_back(symbol);
+        name_offsets_out[file_slot].push_back(occurrence.offset);
+      }
+    }
+  }
+  return true;
+}
+
+bool
+DataBase::readFileTrigrams(const std::vector<u32>& file_slots,
+                           std::vector<std::vector<u32>>& trigrams_out) {
+  const SectionEntry* trigram_section =
+    findSection(SectionKind::CONTENT_TRIGRAMS);
+  std::vector<u8> trigram_table;
+  if (trigram_section == nullptr ||
+      !readSection(*trigram_section, trigram_table) ||
+      trigram_table.size() < sizeof(TrigramTableHeader)) {
+    return false;
+  }
+  TrigramTableHeader table_header;
+  memcpy(&table_header, trigram_table.data(), sizeof(TrigramTableHeader));
+  if (table_header.trigram_count >
+      (trigram_table.size() - sizeof(TrigramTableHeader)) /
+      sizeof(TrigramEntry)) {
+    return false;
+  }
+
+  std::vector<u32> ids;
+  for (u32 trigram = 0; trigram < table_header.trigram_count; ++trigram) {
+    TrigramEntry entry;
+    memcpy(&entry,
+           trigram_table.data() + sizeof(TrigramTableHeader) +
+             u64(trigram) * sizeof(TrigramEntry),
+           sizeof(TrigramEntry));
+    ids.resize(entry.id_count);
+    if (entry.ids_offset > trigram_table.size() ||
+        entry.ids_size > trigram_table.size() - entry.ids_offset) {
+      return false;
+    }
+    const u8* encoded = trigram_table.data() + entry.ids_offset;
+    if (decodeValues(encoded, encoded + entry.ids_size,
+                     entry.id_count, ids.data()) == nullptr) {
+      return false;
+    }
+    prefixSum(ids.data(), entry.id_count);
+    for (u32 id : ids) {
+      if (id < file_slots.size() && file_slots[id] != ~u32(0)) {
+        trigrams_out[file_slots[id]].push_back(entry.trigram);
+      }
+    }
+  }
+  return true;
+}
+
+bool
+DataBase::readStringPool(StringPool& string_pool_out) {
+  const SectionEntry* string_pool = findSection(SectionKind::STRING_POOL);
+  std::vector<u8> pool_bytes;
+  return string_pool != nullptr &&
+         readSection(*string_pool, pool_bytes) &&
+         string_pool_out.deserialize(pool_bytes.data(), pool_bytes.size());
+}
+
+bool
+DataBase::replaceIndexFile(const std::string& built_path) {
+  release();
+  if (rename(built_path.c_str(), file_path.c_str()) != 0) {
+    // Renaming over an existing file fails on win32
+    remove(file_path.c_str());
+    if (rename(built_path.c_str(), file_path.c_str()) != 0) {
+      std::cerr << "Replacing index file failed" << std::endl;
+      return false;
+    }
+  }
+  return load();
+}
+
+bool
+DataBase::updateFileTimes(const std::vector<u64>& modification_times,
+                          u64 build_time) {
+  const SectionEntry* file_table = findSection(SectionKind::FILE_TABLE);
+  if (file_table == nullptr) {
+    return false;
+  }
+  const u64 records_offset = file_table->offset + sizeof(FileTableHeader);
+  std::vector<u32> changed_ids;
+  for (u32 file_id = 0; file_id < modification_times.size(); ++file_id) {
+    FileRecord record;
+    if (!readFileRecord(file_id, record)) {
+      return false;
+    }
+    if (record.modification_time != modification_times[file_id]) {
+      changed_ids.push_back(file_id);
+    }
+  }
+
+  release();
+  FILE* index_file = fopen(file_path.c_str(), "r+b");
+  if (index_file == nullptr) {
+    std::cerr << "Updating index file failed" << std::endl;
+    return false;
+  }
+  bool written = true;
+  for (u32 file_id : changed_ids) {
+    const u64 time_offset = records_offset +
+                            u64(file_id) * sizeof(FileRecord) +
+                            offsetof(FileRecord, modification_time);
+    written = written &&
+              fseek(index_file, static_cast<long>(time_offset),
+                    SEEK_SET) == 0 &&
+              fwrite(&modification_times[file_id], sizeof(u64), 1,
+                     index_file) == 1;
+  }
+  // Last, so that an interrupted update leaves the files it missed to be
+  // hashed next time
+  written = written &&
+            fseek(index_file, offsetof(IndexHeader, build_time),
+                  SEEK_SET) == 0 &&
+            fwrite(&build_time, sizeof(u64), 1, index_file) == 1;
+  written = fclose(index_file) == 0 && written;
+  if (!written) {
+    std::cerr << "Updating index file failed" << std::endl;
+  }
+  return load() && written;
+}
+
+u32
+DataBase::stringCount() {
+  const SectionEntry* string_pool = findSection(SectionKind::STRING_POOL);
+  StringPoolHeader pool_header;
+  if (string_pool == nullptr ||
+      !readSectionValue(*string_pool, 0, pool_header)) {
+    return 0;
+  }
+  return pool_header.string_count;
+}
+
+// Probes the pool's slots in place like StringPool::find()
+bool
+DataBase::findString(const char* string, u32 length, u32& id_out) {
+  const SectionEntry* string_pool = findSection(SectionKind::STRING_POOL);
+  StringPoolHeader pool_header;
+  if (string_pool == nullptr ||
+      !readSectionValue(*string_pool, 0, pool_header) ||
+      pool_header.slot_count == 0) {
+    return false;
+  }
+
+  const u32 slot_mask = pool_header.slot_count - 1;
+  u32 slot = hashString(string, length) & slot_mask;
+  for (u32 probe = 0; probe < pool_header.slot_count; ++probe) {
+    u32 slot_entry = 0;
+    if (!readSectionValue(*string_pool,
+                          pool_header.slots_offset + u64(slot) * sizeof(u32),
+                          slot_entry) ||
+        slot_entry == 0) {
+      return false;
+    }
+
+    u64 string_begin = 0;
+    u64 string_end = 0;
+    if (readStringSpan(*string_pool, slot_entry - 1,
+                       string_begin, string_end) &&
+        string_end - string_begin == length) {
+      std::vector<u8> spill;
+      const u8* candidate =
+        sectionBytes(*string_pool, pool_header.bytes_offset + string_begin,
+                     length, spill);
+      if (candidate != nullptr && memcmp(candidate, string, length) == 0) {
+        id_out = slot_entry - 1;
+        return true;
+      }
+    }
+    slot = (slot + 1) & slot_mask;
+  }
+  return false;
+}
+
+std::string
+DataBase::internedString(u32 id) {
+  const SectionEntry* string_pool = findSection(SectionKind::STRING_POOL);
+  StringPoolHeader pool_header;
+  u64 string_begin = 0;
+  u64 string_end = 0;
+  if (string_pool == nullptr ||
+      !readSectionValue(*string_pool, 0, pool_header) ||
+      id >= pool_header.string_count ||
+      !readStringSpan(*string_pool, id, string_begin, string_end)) {
+    return std::string();
+  }
+  std::vector<u8> spill;
+  const u8* string = sectionBytes(*string_pool,
+                                  pool_header.bytes_offset + string_begin,
+                                  string_end - string_begin,
+                                  spill);
+  if (string == nullptr) {
+    return std::string();
+  }
+  return std::string(reinterpret_cast<const char*>(string),
+                     string_end - string_begin);
+}
+
+bool
+DataBase::findOccurrences(u32 string_id,
+                          std::vector<Occurrence>& occurrences_out) {
+  const SectionEntry* symbol_table = findSection(SectionKind::SYMBOL_TABLE);
+  const SectionEntry* postings = findSection(SectionKind::POSTINGS);
+  SymbolTableHeader table_header;
+  SymbolEntry entry;
+  if (symbol_table == nullptr || postings == nullptr ||
+      !readSectionValue(*symbol_table, 0, table_header) ||
+      string_id >= table_header.symbol_count ||
+      !readSectionValue(*symbol_table,
+                        sizeof(SymbolTableHeader) +
+                          u64(string_id) * sizeof(SymbolEntry),
+                        entry)) {
+    return false;
+  }
+
+  std::vector<u8> spill;
+  const u8* encoded = sectionBytes(*postings, entry.postings_offset,
+                                   entry.postings_size, spill);
+  return encoded != nullptr &&
+         decodePostings(entry, encoded, occurrences_out);
+}
+
+// A Lexer of the single rule regex finds its matches
+SearchStatus
+DataBase::searchNames(const char* regex, std::vector<u32>& string_ids_out) {
+  if (!isValidRegex(regex)) {
+    return SearchStatus::INVALID_REGEX;
+  }
+  const SectionEntry* name_trigrams =
+    findSection(SectionKind::NAME_TRIGRAMS);
+  if (name_trigrams == nullptr) {
+    return SearchStatus::NO_TRIGRAM_SECTION;
+  }
+  std::vector<u32> candidates;
+  const bool filtered = trigramCandidates(*name_trigrams,
+                                          regexTrigramQuery(regex),
+                                          candidates);
+  if (!filtered) {
+    candidates.resize(stringCount());
+    for (u32 string_id = 0; string_id < candidates.size(); ++string_id) {
+      candidates[string_id] = string_id;
+    }
+  }
+
+  Lexer regex_lexer;
+  regex_lexer.addRule(Regexpr(regex), 1);
+  regex_lexer.build();
+
+  TokenBuffer matches;
+  for (u32 string_id : candidates) {
+    const std::string string = internedString(string_id);
+    matches.clear();
+    regex_lexer.tokenize(string.data(), string.data() + string.size(),
+                         matches);
+    if (matches.size() != 0) {
+      string_ids_out.push_back(string_id);
+    }
+  }
+  return SearchStatus::DONE;
+}
+
+SearchStatus
+DataBase::searchFiles(const char* regex,
+                      WorkStealingPool& pool,
+                      std::vector<RegexMatch>& matches_out) {
+  if (!isValidRegex(regex)) {
+    return SearchStatus::INVALID_REGEX;
+  }
+  const SectionEntry* content_trigrams =
+    findSection(SectionKind::CONTENT_TRIGRAMS);
+  if (content_trigrams == nullptr) {
+    return SearchStatus::NO_TRIGRAM_SECTION;
+  }
+  std::vector<u32> candidates;
+  const bool filtered = trigramCandidates(*content_trigrams,
+                                          regexTrigramQuery(regex),
+                                          candidates);
+  if (!filtered) {
+    candidates.resize(fileCount());
+    for (u32 file_id = 0; file_id < candidates.size(); ++file_id) {
+      candidates[file_id] = file_id;
+    }
+  }
+  std::vector<std::string> candidate_paths;
+  for (u32 file_id : candidates) {
+    candidate_paths.push_back(filePath(file_id));
+  }
+
+  Lexer regex_lexer;
+  regex_lexer.addRule(Regexpr(regex), 1);
+  regex_lexer.build();
+
+  std::vector<TokenBuffer> candidate_matches(candidates.size());
+  pool.parallelFor(candidates.size(), [&](size_t candidate, u32) {
+    FileMapper file_map(candidate_paths[candidate].c_str(),
+                        MapAccess::READ_SEQUENTIAL);
+    const u64 file_size = file_map.getFileSize();
+    if (file_size == 0) {
+      return;
+    }
+    const char* file_begin =
+      static_cast<const char*>(file_map.map(0, file_size));
+    if (file_begin != nullptr) {
+      regex_lexer.tokenize(file_begin, file_begin + file_size,
+                           candidate_matches[candidate]);
+      file_map.unmap(const_cast<char*>(file_begin), file_size);
+    }
+  });
+
+  for (size_t candidate = 0; candidate < candidates.size(); ++candidate) {
+    const TokenBuffer& matches = candidate_matches[candidate];
+    for (size_t match = 0; match < matches.size(); ++match) {
+      matches_out.push_back({candidates[candidate],
+                             matches.index[match],
+                             matches.length[match]});
+    }
+  }
+  return SearchStatus::DONE;
+}
+
+bool
+DataBase::trigramCandidates(const SectionEntry& trigram_table,
+                            const TrigramQuery& query,
+                            std::vector<u32>& ids_out) {
+  if (query.op == TrigramQuery::Op::ALL) {
+    return false;
+  }
+
+  // Each trigram and subquery either restricts the ids to a sorted list
+  // or admits all of them
+  bool restricted = false;
+  std::vector<u32> ids;
+  std::vector<u32> combined;
+  const size_t operand_count = query.trigrams.size() + query.subqueries.size();
+  for (size_t operand = 0; operand < operand_count; ++operand) {
+    ids.clear();
+    bool operand_restricts = true;
+    if (operand < query.trigrams.size()) {
+      trigramIds(trigram_table, query.trigrams[operand], ids);
+    } else {
+      operand_restricts = trigramCandidates(
+        trigram_table,
+        query.subqueries[operand - query.trigrams.size()],
+        ids);
+    }
+
+    if (query.op == TrigramQuery::Op::AND) {
+      if (!operand_restricts) {
+        continue;
+      }
+      if (!restricted) {
+        ids_out.swap(ids);
+        restricted = true;
+      } else {
+        combined.clear();
+        std::set_intersection(ids_out.begin(), ids_out.end(),
+                              ids.begin(), ids.end(),
+                              std::back_inserter(combined));
+        ids_out.swap(combined);
+      }
+      if (ids_out.empty()) {
+        return true;
+      }
+    } else {
+      if (!operand_restricts) {
+        ids_out.clear();
+        return false;
+      }
+      combined.clear();
+      std::set_union(ids_out.begin(), ids_out.end(),
+                     ids.begin(), ids.end(),
+                     std::back_inserter(combined));
+      ids_out.swap(combined);
+      restricted = true;
+    }
+  }
+  return restricted;
+}
+
+// Binary search over the sorted entries in place, no entry means no id
+// contains the trigram
+void
+DataBase::trigramIds(const SectionEntry& trigram_table,
+                     u32 trigram,
+                     std::vector<u32>& ids_out) {
+  TrigramTableHeader table_header;
+  if (!readSectionValue(trigram_table, 0, table_header)) {
+    return;
+  }
+  u32 low = 0;
+  u32 high = table_header.trigram_count;
+  while (low < high) {
+    const u32 middle = low + (high - low) / 2;
+    TrigramEntry entry;
+    if (!readSectionValue(trigram_table,
+                          sizeof(TrigramTableHeader) +
+                            u64(middle) * sizeof(TrigramEntry),
+                          entry)) {
+      return;
+    }
+    if (entry.trigram < trigram) {
+      low = middle + 1;
+    } else if (entry.trigram > trigram) {
+      high = middle;
+    } else {
+      std::vector<u8> spill;
+      const u8* encoded = sectionBytes(trigram_table, entry.ids_offset,
+                                       entry.ids_size, spill);
+      ids_out.resize(entry.id_count);
+      if (encoded == nullptr ||
+          decodeValues(encoded, encoded + entry.ids_size,
+                       entry.id_count, ids_out.data()) == nullptr) {
+        ids_out.clear();
+        return;
+      }
+      prefixSum(ids_out.data(), entry.id_count);
+      return;
+    }
+  }
+}
+
+bool
+DataBase::readStringSpan(const SectionEntry& string_pool,
+                         u32 id,
+                         u64& begin_out,
+                         u64& end_out) {
+  u64 string_offsets[2];
+  if (!readSectionValue(string_pool,
+                        sizeof(StringPoolHeader) + u64(id) * sizeof(u64),
+                        string_offsets) ||
+      string_offsets[1] < string_offsets[0]) {
+    return false;
+  }
+  begin_out = string_offsets[0];
+  end_out = string_offsets[1];
+  return true;
+}
+
+const SectionEntry*
+DataBase::findSection(SectionKind kind) {
+  for (const SectionEntry& section : sections) {
+    if (section.kind == kind) {
+      return &section;
+    }
+  }
+  return nullptr;
 }
 
-void DataBase::release() {
-  file_mapper.unmap(file_begin, HEADER_LAST);
+const u8*
+DataBase::sectionBytes(const SectionEntry& section,
+                       u64 offset,
+                       u64 length,
+                       std::vector<u8>& spill) {
+  if (!loaded || offset > section.size || length > section.size - offset) {
+    return nullptr;
+  }
+  if (length <= windows->windowSize()) {
+    return windows->access(section.offset + offset, length);
+  }
+  spill.resize(length);
+  if (!file_mapper->read(section.offset + offset, spill.data(), length)) {
+    return nullptr;
+  }
+  return spill.data();
 }
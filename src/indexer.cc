@@ -0,0 +1,207 @@
+// Command line front end of the index database.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "cpp_lexer.h"
+#include "file_crawler.h"
+#include "index_database.h"
+#include "line_index.h"
+#include "work_stealing_pool.h"
+
+// Every C++ source below root_path, sorted so that rebuilding an
+// unchanged tree numbers its files the same
+internal_ std::vector<std::string>
+crawlSourceTree(const char* root_path) {
+  WorkStealingPool discovery_pool(4);
+  BoundedQueue<CrawledFileBatch> batches(64);
+  FileCrawler crawler(CrawlOptions(), discovery_pool, batches);
+  crawler.crawl(root_path);
+
+  std::vector<std::string> file_paths;
+  CrawledFileBatch batch;
+  while (batches.pop(batch)) {
+    for (CrawledFile& file : batch) {
+      file_paths.push_back(std::move(file.path));
+    }
+  }
+  std::sort(file_paths.begin(), file_paths.end());
+  return file_paths;
+}
+
+internal_ void
+printFiles(DataBase& database) {
+  const u32 file_count = database.fileCount();
+  for (u32 file_id = 0; file_id < file_count; ++file_id) {
+    printf("%u %s %llu bytes\n",
+           file_id,
+           database.filePath(file_id).c_str(),
+           static_cast<unsigned long long>(database.fileSize(file_id)));
+  }
+}
+
+// Prints positions in the indexed files as path:line:column, resolving
+// lines through a LineIndex of the file the last position was in
+class PositionPrinter {
+public:
+  PositionPrinter(DataBase& database) :
+      database(database),
+      file_id(~u32(0)) {
+
+  }
+
+  void print(u32 file_id, u64 offset) {
+    if (file_id != this->file_id) {
+      this->file_id = file_id;
+      file_path = database.filePath(file_id);
+
+      FileMapper file_map(file_path.c_str(), MapAccess::READ_SEQUENTIAL);
+      const u64 file_size = file_map.getFileSize();
+      const char* file_begin =
+        static_cast<const char*>(file_map.map(0, file_size));
+      line_index.clear();
+      if (file_begin != nullptr) {
+        line_index.build(file_begin, file_begin + file_size);
+        file_map.unmap(const_cast<char*>(file_begin), file_size);
+      }
+    }
+    u32 line = 0;
+    u32 column = 0;
+    line_index.resolve(offset, line, column);
+    printf("%s:%u:%u\n", file_path.c_str(), line, column);
+  }
+
+private:
+  DataBase& database;
+  u32 file_id;
+  std::string file_path;
+  LineIndex line_index;
+};
+
+internal_ void
+findName(DataBase& database, const char* name) {
+  u32 string_id = 0;
+  if (!database.findString(name, static_cast<u32>(strlen(name)), string_id)) {
+    printf("%s is not indexed\n", name);
+    return;
+  }
+
+  std::vector<Occurrence> occurrences;
+  if (!database.findOccurrences(string_id, occurrences)) {
+    printf("Reading the postings of %s failed\n", name);
+    return;
+  }
+
+  PositionPrinter printer(database);
+  for (const Occurrence& occurrence : occurrences) {
+    printer.print(occurrence.file_id, occurrence.offset);
+  }
+  printf("%s occurs %zu times\n", name, occurrences.size());
+}
+
+// Prints why a search didn't run, false if it did
+internal_ bool
+searchFailed(SearchStatus status, const char* regex) {
+  switch (status) {
+    case SearchStatus::INVALID_REGEX: {
+      printf("%s is not a valid regular expression\n", regex);
+      return true;
+    }
+    case SearchStatus::NO_TRIGRAM_SECTION: {
+      puts("The index has no trigrams to search");
+      return true;
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+internal_ void
+searchNames(DataBase& database, const char* regex) {
+  std::vector<u32> string_ids;
+  if (searchFailed(database.searchNames(regex, string_ids), regex)) {
+    return;
+  }
+  for (u32 string_id : string_ids) {
+    puts(database.internedString(string_id).c_str());
+  }
+  printf("%zu names match %s\n", string_ids.size(), regex);
+}
+
+internal_ void
+searchFiles(DataBase& database, const char* regex) {
+  WorkStealingPool pool;
+  std::vector<RegexMatch> matches;
+  if (searchFailed(database.searchFiles(regex, pool, matches), regex)) {
+    return;
+  }
+  PositionPrinter printer(database);
+  for (const RegexMatch& match : matches) {
+    printer.print(match.file_id, match.offset);
+  }
+  printf("%zu matches of %s\n", matches.size(), regex);
+}
+
+// args: index_file [(-b | -u) (-r source_root | file...)] [-l] [-f name]
+//       [-s regex] [-g regex]
+//  -b  builds the index of the files found below source_root, or of the
+//      files given, replacing the index file
+//  -u  like -b, but only lexes the files which changed since the index
+//      file was built
+//  -l  lists the indexed files
+//  -f  lists where a name occurs
+//  -s  lists the names matching a regular expression
+//  -g  lists the matches of a regular expression in the indexed files
+int main(int argc, char* args[]) {
+  if (argc < 3) {
+    puts("Expected arguments : index file [(-b | -u) (-r source root | "
+         "names of files to index)] [-l] [-f name] [-s regex] [-g regex]");
+    exit(EXIT_FAILURE);
+  }
+
+  DataBase database(args[1]);
+  for (int arg = 2; arg < argc; ++arg) {
+    if (strcmp(args[arg], "-b") == 0 || strcmp(args[arg], "-u") == 0) {
+      const bool update = args[arg][1] == 'u';
+      std::vector<std::string> file_paths;
+      if (arg + 2 < argc && strcmp(args[arg + 1], "-r") == 0) {
+        file_paths = crawlSourceTree(args[arg + 2]);
+        arg += 2;
+      } else {
+        while (arg + 1 < argc && args[arg + 1][0] != '-') {
+          file_paths.push_back(args[++arg]);
+        }
+      }
+
+      buildCppLexer();
+      WorkStealingPool pool;
+      if (update ? !database.partialBuild(file_paths, pool) :
+                   !database.build(file_paths, pool)) {
+        puts("Building the index failed");
+        exit(EXIT_FAILURE);
+      }
+      printf("Indexed %u files, %u distinct names\n",
+             database.fileCount(),
+             database.stringCount());
+    } else if (strcmp(args[arg], "-l") == 0) {
+      if (!database.isLoaded()) {
+        puts("No valid index to list");
+        exit(EXIT_FAILURE);
+      }
+      printFiles(database);
+    } else if (strcmp(args[arg], "-f") == 0 && arg + 1 < argc) {
+      findName(database, args[++arg]);
+    } else if (strcmp(args[arg], "-s") == 0 && arg + 1 < argc) {
+      searchNames(database, args[++arg]);
+    } else if (strcmp(args[arg], "-g") == 0 && arg + 1 < argc) {
+      searchFiles(database, args[++arg]);
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
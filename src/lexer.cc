@@ -1,46 +1,122 @@
 
 #include "lexer.h"
 
+#include <cstdio>
 #include <cstring>
 #include <vector>
 #include <iostream>
 #include <cassert>
+#include <limits>
 
 #include "file_mapped_io.h"
 #include "regex.h"
 #include "finite_automata.h"
 #include "utils.h"
-
-internal_ inline void resolveLineTracking(LexingIterator& lex_data); 
-internal_ inline void setTokenStartAsNext(LexingIterator& lex_data); 
-internal_ inline void setTokenStartAsCurrent(LexingIterator& lex_data); 
-
+#include "simd_scan.h"
+
+const u8 ScanSkips::NO_SKIP;
+
+template <typename S>
+internal_ void buildScanSkips(const LexerDFA<S>& dfa, ScanSkips& skips_out);
+
+template <typename S>
+internal_ inline bool continueMatch(const LexerDFA<S>& dfa,
+                                    const ScanSkips& skips,
+                                    S& state,
+                                    const char*& input_itr,
+                                    const char* input_end,
+                                    const char*& token_end,
+                                    int& token_id);
+
+template <typename S>
+internal_ inline const char* longestMatch(const LexerDFA<S>& dfa,
+                                          const ScanSkips& skips,
+                                          const char* input_itr,
+                                          const char* input_end,
+                                          int& token_id);
+
+template <typename S>
 void
-resolveLineTracking(LexingIterator& lex_data) {
-  if (*lex_data.itr == '\n') {
-    ++lex_data.line_count;
-    lex_data.last_line_begin = lex_data.itr;
+buildScanSkips(const LexerDFA<S>& dfa, ScanSkips& skips_out) {
+  skips_out.escape_count.assign(dfa.size(), ScanSkips::NO_SKIP);
+  skips_out.escape_bytes.assign(dfa.size() * 3, 0);
+
+  for (size_t state = dfa.begin_state; state < dfa.size(); ++state) {
+    u8 escape_count = 0;
+    for (u32 ch = 0; ch < 0x80 && escape_count <= 3; ++ch) {
+      if (dfa.transition(state, ch) != state) {
+        if (escape_count < 3) {
+          skips_out.escape_bytes[state * 3 + escape_count] = ch;
+        }
+        ++escape_count;
+      }
+    }
+    if (escape_count <= 3) {
+      skips_out.escape_count[state] = escape_count;
+    }
   }
+
+  for (u32 ch = 0; ch < 256; ++ch) {
+    skips_out.dead_start[ch] =
+      dfa.transition(dfa.begin_state, ch) == dfa.garbage_state;
+  }
+  skips_out.skip_whitespace = skips_out.dead_start[u8(' ')] &&
+                              skips_out.dead_start[u8('\t')] &&
+                              skips_out.dead_start[u8('\r')] &&
+                              skips_out.dead_start[u8('\n')];
 }
 
-void
-setTokenStartAsNext(LexingIterator& lex_data) {
-  lex_data.token_begin = lex_data.itr + 1;
-  lex_data.token_line = lex_data.line_count;
+// Walks the DFA on from state until it falls into the garbage state,
+// which completes the match, or input_end is reached first. token_end
+// and token_id are updated whenever an accepting state is seen. Returns
+// whether the match is complete; if not, it can be continued on more
+// input with the same state.
+template <typename S>
+bool
+continueMatch(const LexerDFA<S>& dfa,
+              const ScanSkips& skips,
+              S& state,
+              const char*& input_itr,
+              const char* input_end,
+              const char*& token_end,
+              int& token_id) {
+  for (; input_itr != input_end; ++input_itr) {
+    const S next_state = dfa.transition(state, *input_itr);
+    if (next_state == dfa.garbage_state) {
+      return true;
+    }
+    if (next_state == state &&
+        skips.escape_count[state] != ScanSkips::NO_SKIP) {
+      // Every byte before the next escape byte loops back into state
+      input_itr = findStopByte(input_itr + 1,
+                               input_end,
+                               skips.escape_bytes.data() + state * 3,
+                               skips.escape_count[state]) - 1;
+    }
+    state = next_state;
 
-  if (*lex_data.token_begin != '\n') {
-    lex_data.token_column = lex_data.token_begin - lex_data.last_line_begin;
-  } else {
-    ++lex_data.token_line;
-    lex_data.token_column = 0;
+    const int state_type = dfa.stateType(state);
+    if (state_type != 0) {
+      token_id = state_type;
+      token_end = input_itr + 1;
+    }
   }
+  return false;
 }
 
-void
-setTokenStartAsCurrent(LexingIterator& lex_data) {
-  lex_data.token_begin = lex_data.itr;
-  lex_data.token_line = lex_data.line_count;
-  lex_data.token_column = lex_data.token_begin - lex_data.last_line_begin;
+// Longest match: walk the DFA until it falls into the garbage state and
+// report where the last accepting state was seen, nullptr if none was.
+template <typename S>
+const char*
+longestMatch(const LexerDFA<S>& dfa,
+             const ScanSkips& skips,
+             const char* input_itr,
+             const char* input_end,
+             int& token_id) {
+  S state = dfa.begin_state;
+  const char* token_end = nullptr;
+  continueMatch(dfa, skips, state, input_itr, input_end, token_end, token_id);
+  return token_end;
 }
 
 
@@ -51,14 +127,26 @@ Token::Token() {
 Token::Token(LexingIterator lex_itr, int token_id) :
     index(lex_itr.token_begin - lex_itr.begin),
     length(lex_itr.itr - lex_itr.token_begin),
-    id(token_id),
-    line_count(lex_itr.token_line),
-    column_count(lex_itr.token_column) {
+    id(token_id) {
+
+}
+
+void
+TokenBuffer::clear() {
+  index.clear();
+  length.clear();
+  id.clear();
+}
 
+size_t
+TokenBuffer::size() const {
+  return id.size();
 }
 
 Lexer::Lexer() :
+    line_index_valid(false),
     status(LexingState::INITIALIZATION_PHASE),
+    state_width(0),
     nfa(nullptr) {
 
 }
@@ -66,11 +154,15 @@ Lexer::Lexer() :
 Lexer::~Lexer() {
   switch (status) {
     case LexingState::BUILD_PHASE : {
-      nfa->~NFA();
+      delete nfa;
       break;
     }
     case LexingState::QUERY_PHASE : {
-//      dfa->~DFA();
+      switch (state_width) {
+        case sizeof(u8):  delete dfa8;  break;
+        case sizeof(u16): delete dfa16; break;
+        case sizeof(u32): delete dfa32; break;
+      }
       break;
     }
     default: {
@@ -83,14 +175,14 @@ void
 Lexer::addRule(const Regexpr regexpr, int token_id) {
   if (status == LexingState::INITIALIZATION_PHASE) {
     status = LexingState::BUILD_PHASE;
-    nfa = new NFA<unsigned int, int, 1<<7>;
+    nfa = new LexerNFA(build_arena);
   }
   assert(status == LexingState::BUILD_PHASE);
 
-  std::vector<unsigned int> tokenized_states =
+  LexerNFA::StateSet tokenized_states =
     nfa->addExprGroup(regexpr.expr_begin,
                       regexpr.expr_end,
-                      std::vector<unsigned int>{nfa->begin_state},
+                      LexerNFA::StateSet(1, nfa->begin_state, build_arena),
                       ExpressionGroupQuantification(1, 1));
 
   bool already_contains_token_higher_prio = false;
@@ -108,15 +200,133 @@ Lexer::addRule(const Regexpr regexpr, int token_id) {
 
 void
 Lexer::build() {
-  // TODO: actually convert nfa to dfa
+  assert(status == LexingState::BUILD_PHASE);
+
+  LexerDFA<u32>* compiled_dfa = new LexerDFA<u32>(*nfa, build_arena);
+  delete nfa;
+  build_arena.release();
+  compiled_dfa->minimize();
+
+  // A narrower state type shrinks the transition table accordingly,
+  // which keeps more of it in cache while lexing.
+  const size_t highest_state = compiled_dfa->size() - 1;
+  if (highest_state <= std::numeric_limits<u8>::max()) {
+    state_width = sizeof(u8);
+    dfa8 = new LexerDFA<u8>(*compiled_dfa);
+    delete compiled_dfa;
+  } else if (highest_state <= std::numeric_limits<u16>::max()) {
+    state_width = sizeof(u16);
+    dfa16 = new LexerDFA<u16>(*compiled_dfa);
+    delete compiled_dfa;
+  } else {
+    state_width = sizeof(u32);
+    dfa32 = compiled_dfa;
+  }
+
+  buildScanSkips();
+  status = LexingState::QUERY_PHASE;
+}
+
+void
+Lexer::buildScanSkips() {
+  switch (state_width) {
+    case sizeof(u8):  ::buildScanSkips(*dfa8,  scan_skips); break;
+    case sizeof(u16): ::buildScanSkips(*dfa16, scan_skips); break;
+    default:          ::buildScanSkips(*dfa32, scan_skips); break;
+  }
+}
+
+void
+Lexer::serialize(std::vector<u8>& tables_out, u32 ruleset_version) const {
+  assert(status == LexingState::QUERY_PHASE);
+
+  switch (state_width) {
+    case sizeof(u8): {
+      tables_out.resize(dfa8->serializedSize());
+      dfa8->serialize(tables_out.data(), ruleset_version);
+      break;
+    }
+    case sizeof(u16): {
+      tables_out.resize(dfa16->serializedSize());
+      dfa16->serialize(tables_out.data(), ruleset_version);
+      break;
+    }
+    default: {
+      tables_out.resize(dfa32->serializedSize());
+      dfa32->serialize(tables_out.data(), ruleset_version);
+      break;
+    }
+  }
+}
+
+bool
+Lexer::save(const char* file_path, u32 ruleset_version) const {
+  std::vector<u8> tables;
+  serialize(tables, ruleset_version);
+
+  FILE* tables_file = fopen(file_path, "wb");
+  if (tables_file == nullptr) {
+    std::cerr << "Opening lexer tables file for writing failed" << std::endl;
+    return false;
+  }
+  const bool write_success =
+    fwrite(tables.data(), 1, tables.size(), tables_file) == tables.size();
+  if (fclose(tables_file) != 0 || !write_success) {
+    std::cerr << "Writing lexer tables file failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool
+Lexer::load(const void* tables_begin, u64 tables_size, u32 ruleset_version) {
+  assert(status == LexingState::INITIALIZATION_PHASE);
+
+  if (tables_begin == nullptr || tables_size < sizeof(DFABlobHeader)) {
+    return false;
+  }
+  const DFABlobHeader* header = static_cast<const DFABlobHeader*>(tables_begin);
+  if (header->tag != ruleset_version) {
+    return false;
+  }
+
+  switch (header->state_width) {
+    case sizeof(u8): {
+      if (!LexerDFA<u8>::isValidBlob(tables_begin, tables_size)) {
+        return false;
+      }
+      dfa8 = new LexerDFA<u8>(header);
+      break;
+    }
+    case sizeof(u16): {
+      if (!LexerDFA<u16>::isValidBlob(tables_begin, tables_size)) {
+        return false;
+      }
+      dfa16 = new LexerDFA<u16>(header);
+      break;
+    }
+    case sizeof(u32): {
+      if (!LexerDFA<u32>::isValidBlob(tables_begin, tables_size)) {
+        return false;
+      }
+      dfa32 = new LexerDFA<u32>(header);
+      break;
+    }
+    default: {
+      return false;
+    }
+  }
+  state_width = header->state_width;
+  buildScanSkips();
   status = LexingState::QUERY_PHASE;
+  return true;
 }
 
 void
 Lexer::setStream(const char* input_data_begin, const char* input_data_end) {
   lexing_data = {input_data_begin, input_data_begin, input_data_end,
-                 input_data_begin - 1, 1,
-                 input_data_begin, 1, 1};
+                 input_data_begin};
+  line_index_valid = false;
 }
 
 const char*
@@ -124,145 +334,355 @@ Lexer::begin() {
   return lexing_data.begin;
 }
 
-/*
-DFA querying will look something like this 
-
 Token
 Lexer::nextToken() {
+  return nextToken(lexing_data);
+}
+
+// Characters that can't begin any token are skipped
+Token
+Lexer::nextToken(LexingIterator& cursor) const {
   assert(status == LexingState::QUERY_PHASE);
-  unsigned int state = dfa.begin_state;
 
-  while (lexing_data.itr != lexing_data.end) {
-    if (*lexing_data.itr == '\n') {
-      ++lexing_data.line_count;
-      lexing_data.last_line_begin = lexing_data.itr;
-    }
-    if (state == dfa.begin_state) {
-      // start over
-      lexing_data.token_begin = lexing_data.itr;
-      lexing_data.token_line = lexing_data.line_count;
-      lexing_data.token_column = lexing_data.itr - lexing_data.last_line_begin;
+  switch (state_width) {
+    case sizeof(u8):  return nextToken(*dfa8,  cursor);
+    case sizeof(u16): return nextToken(*dfa16, cursor);
+    default:          return nextToken(*dfa32, cursor);
+  }
+}
+
+template <typename S>
+Token
+Lexer::nextToken(const LexerDFA<S>& dfa, LexingIterator& cursor) const {
+  while (cursor.itr != cursor.end) {
+    if (scan_skips.dead_start[static_cast<u8>(*cursor.itr)]) {
+      cursor.itr = scan_skips.skip_whitespace ?
+                     skipWhitespace(cursor.itr + 1, cursor.end) :
+                     cursor.itr + 1;
+      continue;
     }
-    state = dfa.states[state * dfa.alphabet_size + (*lexing_data.itr)];
-    ++lexing_data.itr;
 
-    auto accept_itr = dfa.accept_states.find(state);
- 
-    if (accept_itr != dfa.accept_states.end()) {
-      return Token(lexing_data, accept_itr->second);
+    int token_id = 0;
+    const char* token_end = longestMatch(dfa,
+                                         scan_skips,
+                                         cursor.itr,
+                                         cursor.end,
+                                         token_id);
+    if (token_end != nullptr) {
+      cursor.token_begin = cursor.itr;
+      cursor.itr = token_end;
+      return Token(cursor, token_id);
     }
+
+    ++cursor.itr;
   }
-  return Token(lexing_data, TokenIdentifier::END_OF_FILE);
+
+  cursor.token_begin = cursor.itr;
+  return Token(cursor, -52); // will be end of file (EOF)
 }
-*/
 
-Token
-Lexer::nextToken() {
+void
+Lexer::tokenize(const char* input_begin,
+                const char* input_end,
+                TokenBuffer& tokens_out) const {
   assert(status == LexingState::QUERY_PHASE);
-  std::vector<unsigned int> tmp_set;
-  std::vector<unsigned int> current_state_set = {nfa->begin_state};
-  current_state_set = nfa->epsilonSearch(current_state_set);
-  // Save state of longest match so far of token and lexing_state
-  Token longest_match_so_far;
-  longest_match_so_far.id = 0;
-
-
-  // Can rewind to lexing state after last token match or to simply skip
-  // meaningless characters
-  // TODO: Might have to deal with line increments here
-  LexingIterator rewind_lexing_state = lexing_data;
-    if (rewind_lexing_state.token_line == 52) {
-      int breakme = 5;
-    }
-  setTokenStartAsNext(rewind_lexing_state);
 
-  for (;
-       ;
-       ++lexing_data.itr) {
-
-    if (lexing_data.itr == lexing_data.end) {
-      if (rewind_lexing_state.itr < lexing_data.itr) {
+  switch (state_width) {
+    case sizeof(u8):  tokenize(*dfa8,  input_begin, input_end, tokens_out); break;
+    case sizeof(u16): tokenize(*dfa16, input_begin, input_end, tokens_out); break;
+    default:          tokenize(*dfa32, input_begin, input_end, tokens_out); break;
+  }
+}
 
-        rewindBackTo(rewind_lexing_state, current_state_set);
-        continue;
+template <typename S>
+void
+Lexer::tokenize(const LexerDFA<S>& dfa,
+                const char* input_begin,
+                const char* input_end,
+                TokenBuffer& tokens_out) const {
+  tokenizeRange(dfa, input_begin, input_begin, input_end, input_end,
+                tokens_out);
+}
 
-      } else {
-        break;
-      }
+template <typename S>
+const char*
+Lexer::tokenizeRange(const LexerDFA<S>& dfa,
+                     const char* input_begin,
+                     const char* scan_begin,
+                     const char* scan_stop,
+                     const char* input_end,
+                     TokenBuffer& tokens_out) const {
+  const char* input_itr = scan_begin;
+  while (input_itr < scan_stop) {
+    if (scan_skips.dead_start[static_cast<u8>(*input_itr)]) {
+      input_itr = scan_skips.skip_whitespace ?
+                    skipWhitespace(input_itr + 1, input_end) :
+                    input_itr + 1;
+      continue;
     }
-    
-    if (lexing_data.line_count == 124) {
-      int breakme = 5;
+
+    int token_id = 0;
+    const char* token_end = longestMatch(dfa,
+                                         scan_skips,
+                                         input_itr,
+                                         input_end,
+                                         token_id);
+    if (token_end == nullptr) {
+      ++input_itr;
+      continue;
     }
-    resolveLineTracking(lexing_data);
+    tokens_out.index.push_back(input_itr - input_begin);
+    tokens_out.length.push_back(static_cast<u32>(token_end - input_itr));
+    tokens_out.id.push_back(token_id);
+    input_itr = token_end;
+  }
+  return input_itr;
+}
 
-    bool is_garbage_set = true;
-    int governing_token = 0;
+void
+Lexer::tokenizeParallel(const char* input_begin,
+                        const char* input_end,
+                        TokenBuffer& tokens_out,
+                        WorkStealingPool& pool,
+                        size_t chunk_size) const {
+  assert(status == LexingState::QUERY_PHASE);
 
-    for (auto current_state : current_state_set) {
-      if (current_state != nfa->garbage_state) {
-        is_garbage_set = false;
-      }
-      const int state_type = nfa->stateType(current_state);
-      if (state_type != nfa->garbage_state) {
-        governing_token = state_type;
-      }
+  switch (state_width) {
+    case sizeof(u8): {
+      tokenizeParallel(*dfa8, input_begin, input_end, tokens_out,
+                       pool, chunk_size);
+      break;
+    }
+    case sizeof(u16): {
+      tokenizeParallel(*dfa16, input_begin, input_end, tokens_out,
+                       pool, chunk_size);
+      break;
     }
+    default: {
+      tokenizeParallel(*dfa32, input_begin, input_end, tokens_out,
+                       pool, chunk_size);
+      break;
+    }
+  }
+}
 
-    if (is_garbage_set) {
-      if (longest_match_so_far.id != 0) {
-        // rewind back to where the token was found
-        lexing_data = rewind_lexing_state;
-        return longest_match_so_far;
+template <typename S>
+void
+Lexer::tokenizeParallel(const LexerDFA<S>& dfa,
+                        const char* input_begin,
+                        const char* input_end,
+                        TokenBuffer& tokens_out,
+                        WorkStealingPool& pool,
+                        size_t chunk_size) const {
+  // Chunk k spans [chunk_begins[k] ; chunk_begins[k + 1][
+  std::vector<const char*> chunk_begins(1, input_begin);
+  for (;;) {
+    const char* chunk_begin = chunk_begins.back();
+    if (static_cast<size_t>(input_end - chunk_begin) < 2 * chunk_size) {
+      break;
+    }
+    const char* line_break =
+      static_cast<const char*>(memchr(chunk_begin + chunk_size,
+                                      '\n',
+                                      input_end - chunk_begin - chunk_size));
+    if (line_break == nullptr || line_break + 1 == input_end) {
+      break;
+    }
+    chunk_begins.push_back(line_break + 1);
+  }
+  chunk_begins.push_back(input_end);
 
-      } else {
+  const size_t chunk_count = chunk_begins.size() - 1;
+  if (chunk_count == 1) {
+    tokenize(dfa, input_begin, input_end, tokens_out);
+    return;
+  }
 
-        rewindBackTo(rewind_lexing_state, current_state_set);
-        continue;
+  // The first chunk starts in sync and is lexed straight into tokens_out
+  std::vector<TokenBuffer> chunk_tokens(chunk_count);
+  std::vector<const char*> chunk_stops(chunk_count);
+  pool.parallelFor(chunk_count, [&](size_t chunk, u32) {
+    TokenBuffer& tokens = chunk == 0 ? tokens_out : chunk_tokens[chunk];
+    chunk_stops[chunk] = tokenizeRange(dfa,
+                                       input_begin,
+                                       chunk_begins[chunk],
+                                       chunk_begins[chunk + 1],
+                                       input_end,
+                                       tokens);
+  });
+
+  const char* scan_itr = chunk_stops[0];
+  for (size_t chunk = 1; chunk < chunk_count; ++chunk) {
+    const TokenBuffer& speculative = chunk_tokens[chunk];
+    const char* chunk_end = chunk_begins[chunk + 1];
+
+    size_t spec_token = 0;
+    bool in_sync = false;
+    while (scan_itr < chunk_end) {
+      const size_t token_count = tokens_out.size();
+      scan_itr = tokenizeRange(dfa, input_begin, scan_itr, scan_itr + 1,
+                               input_end, tokens_out);
+      if (tokens_out.size() == token_count) {
+        continue; // skipped bytes which can't begin a token
       }
-    } else if (governing_token != 0){
-      longest_match_so_far = Token(lexing_data, governing_token);
-      // set rewind state to continue after where token ends
-      rewind_lexing_state = lexing_data;
-      setTokenStartAsCurrent(rewind_lexing_state);
-    }
 
-    tmp_set.clear();
-    for (auto current_state : current_state_set) {
-      unsigned int transition_state = nfa->transition(current_state,
-                                                      *lexing_data.itr);
-      if (transition_state != nfa->garbage_state) {
-        tmp_set.push_back(transition_state);
+      const u64 token_index = tokens_out.index.back();
+      while (spec_token < speculative.size() &&
+             speculative.index[spec_token] < token_index) {
+        ++spec_token;
+      }
+      if (spec_token < speculative.size() &&
+          speculative.index[spec_token] == token_index) {
+        in_sync = true;
+        break;
       }
     }
-    // branch out after
-    current_state_set = nfa->epsilonSearch(tmp_set);
-  }
 
-  return Token(lexing_data, -52); // will be end of file (EOF)
+    if (in_sync) {
+      // Matched tokens starting at the same index are identical, and so
+      // is everything lexed after them
+      ++spec_token;
+      tokens_out.index.insert(tokens_out.index.end(),
+                              speculative.index.begin() + spec_token,
+                              speculative.index.end());
+      tokens_out.length.insert(tokens_out.length.end(),
+                               speculative.length.begin() + spec_token,
+                               speculative.length.end());
+      tokens_out.id.insert(tokens_out.id.end(),
+                           speculative.id.begin() + spec_token,
+                           speculative.id.end());
+      scan_itr = chunk_stops[chunk];
+    }
+  }
 }
 
 void
 Lexer::rewind() {
   lexing_data.itr = lexing_data.begin;
-
-  lexing_data.last_line_begin = lexing_data.begin - 1;
   lexing_data.token_begin = lexing_data.begin;
+}
+
+void
+Lexer::position(const Token& token, u32& line_out, u32& column_out) {
+  if (!line_index_valid) {
+    line_index.build(lexing_data.begin, lexing_data.end);
+    line_index_valid = true;
+  }
+  line_index.resolve(token.index, line_out, column_out);
+}
+
+StreamingLexer::StreamingLexer(const Lexer& lexer) :
+    lexer(lexer) {
+  reset();
+}
+
+void
+StreamingLexer::feed(const char* chunk_begin,
+                     const char* chunk_end,
+                     TokenBuffer& tokens_out) {
+  assert(lexer.status == Lexer::LexingState::QUERY_PHASE);
+
+  // Drop the input before the pending match, every token in it is out
+  buffer_data.erase(buffer_data.begin(), buffer_data.begin() + scan);
+  buffer_offset += scan;
+  match_itr -= scan;
+  if (match_end != 0) {
+    match_end -= scan;
+  }
+  scan = 0;
+  buffer_data.insert(buffer_data.end(), chunk_begin, chunk_end);
+
+  switch (lexer.state_width) {
+    case sizeof(u8):  lexBuffer(*lexer.dfa8,  false, tokens_out); break;
+    case sizeof(u16): lexBuffer(*lexer.dfa16, false, tokens_out); break;
+    default:          lexBuffer(*lexer.dfa32, false, tokens_out); break;
+  }
+}
 
-  lexing_data.line_count = 1;
+void
+StreamingLexer::finish(TokenBuffer& tokens_out) {
+  assert(lexer.status == Lexer::LexingState::QUERY_PHASE);
+
+  switch (lexer.state_width) {
+    case sizeof(u8):  lexBuffer(*lexer.dfa8,  true, tokens_out); break;
+    case sizeof(u16): lexBuffer(*lexer.dfa16, true, tokens_out); break;
+    default:          lexBuffer(*lexer.dfa32, true, tokens_out); break;
+  }
 }
 
 void
-Lexer::rewindBackTo(LexingIterator& rewind_data,
-                    std::vector<unsigned int>& state_set) {
-  
-  lexing_data = rewind_data;
-  ++rewind_data.itr;
-  resolveLineTracking(rewind_data);
-  setTokenStartAsNext(rewind_data);
-
-  state_set.clear();
-  state_set.push_back(nfa->begin_state);
-  state_set = nfa->epsilonSearch(state_set);
+StreamingLexer::reset() {
+  buffer_data.clear();
+  buffer_offset = 0;
+  scan = 0;
+  in_match = false;
+  match_state = 0;
+  match_itr = 0;
+  match_end = 0;
+  match_id = 0;
+}
+
+const char*
+StreamingLexer::buffer() const {
+  return buffer_data.data();
+}
 
+u64
+StreamingLexer::bufferOffset() const {
+  return buffer_offset;
+}
+
+// Lexer::tokenizeRange() over the buffer, except that a match reaching
+// the buffer's end is suspended rather than taken as complete unless the
+// input has ended.
+template <typename S>
+void
+StreamingLexer::lexBuffer(const LexerDFA<S>& dfa,
+                          bool input_ended,
+                          TokenBuffer& tokens_out) {
+  const ScanSkips& skips = lexer.scan_skips;
+  const char* buffer_begin = buffer_data.data();
+  const char* buffer_end = buffer_begin + buffer_data.size();
+
+  for (;;) {
+    if (!in_match) {
+      if (scan == buffer_data.size()) {
+        return;
+      }
+      const char* scan_itr = buffer_begin + scan;
+      if (skips.dead_start[static_cast<u8>(*scan_itr)]) {
+        scan = (skips.skip_whitespace ?
+                  skipWhitespace(scan_itr + 1, buffer_end) :
+                  scan_itr + 1) - buffer_begin;
+        continue;
+      }
+      in_match = true;
+      match_state = dfa.begin_state;
+      match_itr = scan;
+      match_end = 0;
+    }
+
+    S state = static_cast<S>(match_state);
+    const char* input_itr = buffer_begin + match_itr;
+    const char* token_end = match_end != 0 ? buffer_begin + match_end : nullptr;
+    const bool complete = continueMatch(dfa, skips, state,
+                                        input_itr, buffer_end,
+                                        token_end, match_id);
+    match_itr = input_itr - buffer_begin;
+    match_end = token_end != nullptr ? token_end - buffer_begin : 0;
+    if (!complete && !input_ended) {
+      match_state = state;
+      return;
+    }
+
+    in_match = false;
+    if (match_end == 0) {
+      ++scan;
+      continue;
+    }
+    tokens_out.index.push_back(buffer_offset + scan);
+    tokens_out.length.push_back(static_cast<u32>(match_end - scan));
+    tokens_out.id.push_back(match_id);
+    scan = match_end;
+  }
 }
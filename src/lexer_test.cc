@@ -2,38 +2,162 @@
 // Print test for the lexer.
 
 #include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <vector>
 
 #include "lexer.h"
 #include "index_database.h"
 #include "file_mapped_io.h"
 #include "cpp_lexer.h"
+#include "work_stealing_pool.h"
 
-// args[1]: filename to be lexed
+// Lexes all files across every core and reports their token counts
+internal_ void
+lexFilesInParallel(const std::vector<std::string>& file_paths) {
+  std::atomic<u64> total_tokens(0);
+  WorkStealingPool pool;
+
+  tokenizeCppFiles(file_paths, pool,
+                   [&total_tokens](const std::string& file_path,
+                                   const char*,
+                                   const char*,
+                                   const TokenBuffer& tokens,
+                                   u32) {
+    const u64 token_count = tokens.size();
+    total_tokens += token_count;
+    printf("%s: %llu tokens\n",
+           file_path.c_str(),
+           static_cast<unsigned long long>(token_count));
+  });
+
+  printf("Lexed %zu files on %u workers, %llu tokens in total\n",
+         file_paths.size(),
+         pool.workerCount(),
+         static_cast<unsigned long long>(total_tokens.load()));
+}
+
+// Lexes every C++ source below root_path while it is being discovered
+internal_ void
+lexSourceTree(const char* root_path) {
+  std::atomic<u64> file_count(0);
+  std::atomic<u64> total_tokens(0);
+  WorkStealingPool discovery_pool(4);
+  WorkStealingPool lexing_pool;
+
+  tokenizeCppSourceTree(root_path, CrawlOptions(),
+                        discovery_pool, lexing_pool,
+                        [&file_count, &total_tokens](const std::string&,
+                                                     const char*,
+                                                     const char*,
+                                                     const TokenBuffer& tokens,
+                                                     u32) {
+    ++file_count;
+    total_tokens += tokens.size();
+  });
+
+  printf("Lexed %llu files below %s, %llu tokens in total\n",
+         static_cast<unsigned long long>(file_count.load()),
+         root_path,
+         static_cast<unsigned long long>(total_tokens.load()));
+}
+
+// Lexes stdin as it arrives, e.g. piped from a preprocessor
+internal_ void
+lexStandardInput() {
+  u64 total_tokens = 0;
+  const bool read_all =
+    tokenizeCppStream(stdin, [&total_tokens](const char*,
+                                             u64,
+                                             const TokenBuffer& tokens) {
+      total_tokens += tokens.size();
+    });
+
+  printf("Lexed %s, %llu tokens in total\n",
+         read_all ? "stdin" : "stdin up to a read error",
+         static_cast<unsigned long long>(total_tokens));
+}
+
+// args: [-t lexer_tables_file] [-s small_file_size]
+//       (-r source_root | file...)
+// The lexer tables file is used in place of building the lexer when
+// valid, otherwise written after building it.
+// Files up to small_file_size bytes are read instead of mapped when
+// lexing several of them.
+// A single file runs the print tests, several files are lexed in
+// parallel and a source root is crawled for files to lex. The file
+// name - lexes stdin.
 int main(int argc, char* args[]) {
 
-  if (argc != 2) {
-    puts("Expected one argument : name of file to be lexed");
+  const char* tables_path = nullptr;
+  const char* root_path = nullptr;
+  std::vector<std::string> file_paths;
+  for (int arg = 1; arg < argc; ++arg) {
+    if (strcmp(args[arg], "-t") == 0 && arg + 1 < argc) {
+      tables_path = args[++arg];
+    } else if (strcmp(args[arg], "-s") == 0 && arg + 1 < argc) {
+      setSmallFileReadLimit(static_cast<u32>(strtoul(args[++arg], nullptr, 10)));
+    } else if (strcmp(args[arg], "-r") == 0 && arg + 1 < argc) {
+      root_path = args[++arg];
+    } else {
+      file_paths.push_back(args[arg]);
+    }
+  }
+  if (file_paths.empty() == (root_path == nullptr)) {
+    puts("Expected arguments : [-t lexer tables file] [-s small file size] "
+         "(-r source root | names of files to be lexed)");
     exit(EXIT_FAILURE);
   }
 
-  FileMapper filemap(args[1]);
-  u32 file_size = static_cast<u32>(filemap.getFileSize());
+  // Load or build cpp lexing ruleset
+  FileMapper* tables_map = nullptr;
+  void* tables_begin = nullptr;
+  u64 tables_size = 0;
+  bool tables_loaded = false;
+  if (tables_path != nullptr) {
+    tables_map = new FileMapper(tables_path, MapAccess::READ_ONLY);
+    tables_size = tables_map->getFileSize();
+    if (tables_size != 0) {
+      tables_begin = tables_map->map(0, tables_size);
+      tables_loaded = loadCppLexer(tables_begin, tables_size);
+    }
+  }
+  if (!tables_loaded) {
+    buildCppLexer();
+    if (tables_path != nullptr) {
+      saveCppLexer(tables_path);
+    }
+  }
+
+  if (root_path != nullptr) {
+    lexSourceTree(root_path);
+  } else if (file_paths.size() == 1 && file_paths[0] == "-") {
+    lexStandardInput();
+  } else if (file_paths.size() > 1) {
+    lexFilesInParallel(file_paths);
+  } else {
+    FileMapper filemap(file_paths[0].c_str(), MapAccess::READ_SEQUENTIAL);
+    u64 file_size = filemap.getFileSize();
+
+    const char* file_begin = static_cast<const char*>(filemap.map(0, file_size));
+    const char* file_end = file_begin + file_size;
 
-  const char* file_begin = static_cast<const char*>(filemap.map(0, file_size));
-  const char* file_end = file_begin + file_size;
-  
-  // Build cpp lexing ruleset
-  buildCppLexer();
-  // Feed our file data stream
-  feedLexer(file_begin, file_end); 
+    // Feed our file data stream
+    feedLexer(file_begin, file_end);
 
-  // Test calls
-  lexerTestPrintAllTokens();
-  lexerTestPrintAllFunctionsCalledInFunctions();
+    // Test calls
+    lexerTestPrintAllTokens();
+    lexerTestPrintAllFunctionsCalledInFunctions();
+
+    filemap.unmap(const_cast<char*>(file_begin), file_size);
+  }
 
   // Cleanup
-  filemap.unmap(const_cast<char*>(file_begin), file_size);
-  
+  if (tables_begin != nullptr) {
+    tables_map->unmap(tables_begin, tables_size);
+  }
+  delete tables_map;
+
   return EXIT_SUCCESS;
 }
-
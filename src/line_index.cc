@@ -0,0 +1,82 @@
+
+#include "line_index.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "utils.h"
+
+void
+LineIndex::build(const char* input_begin, const char* input_end) {
+  newline_offsets.clear();
+
+  const char* input_itr = input_begin;
+
+#if defined(__AVX2__)
+  const __m256i newline_bytes = _mm256_set1_epi8('\n');
+  for (; input_end - input_itr >= 32; input_itr += 32) {
+    const __m256i block =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input_itr));
+    u32 newline_mask = static_cast<u32>(
+      _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline_bytes)));
+
+    for (; newline_mask != 0; newline_mask &= newline_mask - 1) {
+      newline_offsets.push_back((input_itr - input_begin) +
+                                countTrailingZeros(newline_mask));
+    }
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  const __m128i newline_bytes = _mm_set1_epi8('\n');
+  for (; input_end - input_itr >= 16; input_itr += 16) {
+    const __m128i block =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_itr));
+    u32 newline_mask = static_cast<u32>(
+      _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline_bytes)));
+
+    for (; newline_mask != 0; newline_mask &= newline_mask - 1) {
+      newline_offsets.push_back((input_itr - input_begin) +
+                                countTrailingZeros(newline_mask));
+    }
+  }
+#endif
+
+  // Remaining tail, or the whole input without SIMD support
+  while (input_itr != input_end) {
+    const char* newline = static_cast<const char*>(
+      memchr(input_itr, '\n', input_end - input_itr));
+    if (newline == nullptr) {
+      break;
+    }
+    newline_offsets.push_back(newline - input_begin);
+    input_itr = newline + 1;
+  }
+}
+
+void
+LineIndex::clear() {
+  newline_offsets.clear();
+}
+
+// A newline belongs to the line it ends
+void
+LineIndex::resolve(u64 index, u32& line_out, u32& column_out) {
+  auto line_end = std::lower_bound(newline_offsets.begin(),
+                                   newline_offsets.end(),
+                                   index);
+  const size_t preceding_lines = line_end - newline_offsets.begin();
+
+  line_out = static_cast<u32>(preceding_lines + 1);
+  column_out = static_cast<u32>(
+    preceding_lines == 0 ? index + 1 : index - *(line_end - 1));
+}
+
+size_t
+LineIndex::lineCount() {
+  return newline_offsets.size() + 1;
+}
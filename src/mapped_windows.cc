@@ -0,0 +1,139 @@
+
+#include "mapped_windows.h"
+
+#include <algorithm>
+#include <cassert>
+
+MappedWindows::MappedWindows(FileMapper& file,
+                             u64 window_size,
+                             u32 window_count) :
+    file(file),
+    file_size(file.getFileSize()),
+    windows(window_count, Window{nullptr, 0, 0, 0}),
+    use_clock(0) {
+  // Windows start at multiples of the mapping alignment
+  const u64 alignment = FileMapper::mapAlignment();
+  this->window_size = (std::max(window_size, alignment) + alignment - 1) /
+                      alignment * alignment;
+}
+
+MappedWindows::~MappedWindows() {
+  release();
+}
+
+u8*
+MappedWindows::access(u64 byte_offset, u64 length, u64* available_out) {
+  assert(length <= window_size);
+  if (byte_offset > file_size || length > file_size - byte_offset) {
+    return nullptr;
+  }
+
+  ++use_clock;
+  Window* replaced = &windows[0];
+  for (Window& window : windows) {
+    if (window.begin != nullptr &&
+        byte_offset >= window.byte_offset &&
+        byte_offset + length <= window.byte_offset + window.length) {
+      window.last_use = use_clock;
+      if (available_out != nullptr) {
+        *available_out = window.byte_offset + window.length - byte_offset;
+      }
+      return window.begin + (byte_offset - window.byte_offset);
+    }
+    if (window.last_use < replaced->last_use) {
+      replaced = &window;
+    }
+  }
+
+  // Windows aligned to the window size are shared by every access within
+  // them, only accesses straddling such a border get a window of their own
+  u64 window_offset = byte_offset / window_size * window_size;
+  if (byte_offset + length > window_offset + window_size) {
+    const u64 alignment = FileMapper::mapAlignment();
+    window_offset = byte_offset / alignment * alignment;
+  }
+  const u64 window_length =
+    std::min(std::max(window_size, byte_offset + length - window_offset),
+             file_size - window_offset);
+
+  if (replaced->begin != nullptr) {
+    file.unmap(replaced->begin, replaced->length);
+    replaced->begin = nullptr;
+  }
+  u8* window_begin = static_cast<u8*>(file.map(window_offset, window_length));
+  if (window_begin == nullptr) {
+    return nullptr;
+  }
+  *replaced = {window_begin, window_offset, window_length, use_clock};
+
+  if (available_out != nullptr) {
+    *available_out = window_offset + window_length - byte_offset;
+  }
+  return window_begin + (byte_offset - window_offset);
+}
+
+void
+MappedWindows::release() {
+  for (Window& window : windows) {
+    if (window.begin != nullptr) {
+      file.unmap(window.begin, window.length);
+      window.begin = nullptr;
+      window.last_use = 0;
+    }
+  }
+}
+
+u64
+MappedWindows::windowSize() {
+  return window_size;
+}
+
+u64
+MappedWindows::fileSize() {
+  return file_size;
+}
+
+WindowCursor::WindowCursor(MappedWindows& windows, u64 byte_offset) :
+    windows(windows),
+    byte_offset(byte_offset),
+    window_itr(nullptr),
+    window_end(nullptr) {
+
+}
+
+const u8*
+WindowCursor::next(u64 length) {
+  if (static_cast<u64>(window_end - window_itr) < length) {
+    // Slide: map a window starting at the cursor
+    u64 available = 0;
+    window_itr = windows.access(byte_offset, length, &available);
+    if (window_itr == nullptr) {
+      window_end = nullptr;
+      return nullptr;
+    }
+    window_end = window_itr + available;
+  }
+
+  const u8* bytes = window_itr;
+  window_itr += length;
+  byte_offset += length;
+  return bytes;
+}
+
+void
+WindowCursor::seek(u64 byte_offset) {
+  this->byte_offset = byte_offset;
+  window_itr = nullptr;
+  window_end = nullptr;
+}
+
+u64
+WindowCursor::offset() {
+  return byte_offset;
+}
+
+u64
+WindowCursor::remaining() {
+  const u64 file_size = windows.fileSize();
+  return byte_offset < file_size ? file_size - byte_offset : 0;
+}
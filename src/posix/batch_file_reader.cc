@@ -0,0 +1,526 @@
+
+#include "batch_file_reader.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+// io_uring is driven through its system calls and shared rings directly,
+// as described in io_uring(7), to keep liburing out of the build.
+
+// Submission queue entries, twice as many completion queue entries
+internal_ const u32 ring_entries = 256;
+
+struct IoRing {
+  int ring_handle;
+
+  u32* sq_head;
+  u32* sq_tail;
+  u32* sq_mask;
+  u32* sq_array;
+  io_uring_sqe* sqes;
+
+  u32* cq_head;
+  u32* cq_tail;
+  u32* cq_mask;
+  io_uring_cqe* cqes;
+
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring; // same as sq_ring with IORING_FEAT_SINGLE_MMAP
+  size_t cq_ring_size;
+  size_t sqes_size;
+
+  u32 sq_entries;
+  u32 to_submit; // queued since the last io_uring_enter()
+};
+
+// A file working its way through openat and statx, read, then close
+struct PendingFile {
+  PendingFile() :
+      file_handle(-1),
+      bytes_read(0),
+      ops_in_ring(0),
+      failed(false),
+      handed_over(false) {
+
+  }
+
+  std::string path;
+  std::shared_ptr<std::vector<char>> contents;
+  struct statx attributes;
+
+  int file_handle;
+  u64 bytes_read;
+  u8 ops_in_ring;
+  bool failed;
+  bool handed_over; // to the pool, read or to be mapped there
+};
+
+// Buffers of small files go back here once their handler returned, for
+// the next files to be read into. Shared with the handlers, which may
+// outlive readAllWithIoRing().
+struct RecycledBuffers {
+  std::shared_ptr<std::vector<char>> take() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (buffers.empty()) {
+      return std::make_shared<std::vector<char>>();
+    }
+    std::shared_ptr<std::vector<char>> buffer = std::move(buffers.back());
+    buffers.pop_back();
+    return buffer;
+  }
+
+  void give(std::shared_ptr<std::vector<char>> buffer) {
+    std::lock_guard<std::mutex> guard(lock);
+    buffers.push_back(std::move(buffer));
+  }
+
+  std::mutex lock;
+  std::vector<std::shared_ptr<std::vector<char>>> buffers;
+};
+
+enum RingOp : u8 {
+  OP_OPEN,
+  OP_STAT,
+  OP_READ,
+  OP_CLOSE
+};
+
+internal_ inline u64
+packUserData(u32 slot, RingOp op) {
+  return (static_cast<u64>(slot) << 8) | op;
+}
+
+internal_ int
+ringSetup(u32 entries, io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+internal_ int
+ringEnter(IoRing& ring, u32 min_complete) {
+  const int submitted =
+    static_cast<int>(syscall(__NR_io_uring_enter,
+                             ring.ring_handle,
+                             ring.to_submit,
+                             min_complete,
+                             min_complete != 0 ? IORING_ENTER_GETEVENTS : 0,
+                             nullptr,
+                             0));
+  if (submitted > 0) {
+    ring.to_submit -= submitted;
+  }
+  return submitted;
+}
+
+// The caller keeps at most sq_entries operations in the ring, so a free
+// submission entry always exists
+internal_ io_uring_sqe&
+nextSqe(IoRing& ring) {
+  const u32 tail = *ring.sq_tail;
+  assert(tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) <
+         ring.sq_entries);
+
+  const u32 index = tail & *ring.sq_mask;
+  io_uring_sqe& sqe = ring.sqes[index];
+  memset(&sqe, 0, sizeof(sqe));
+  ring.sq_array[index] = index;
+  return sqe;
+}
+
+internal_ void
+queueSqe(IoRing& ring) {
+  __atomic_store_n(ring.sq_tail, *ring.sq_tail + 1, __ATOMIC_RELEASE);
+  ++ring.to_submit;
+}
+
+void
+BatchFileReader::openIoRing() {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  const int ring_handle = ringSetup(ring_entries, &params);
+  if (ring_handle < 0) {
+    return; // no io_uring, e.g. an old kernel or a seccomp sandbox
+  }
+  // Arrived in Linux 5.6 together with openat, statx and read
+  if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+    close(ring_handle);
+    return;
+  }
+
+  IoRing* ring = new IoRing;
+  ring->ring_handle = ring_handle;
+  ring->sq_entries = params.sq_entries;
+  ring->to_submit = 0;
+
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+  ring->cq_ring_size = params.cq_off.cqes +
+                       params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_map) {
+    ring->sq_ring_size = ring->cq_ring_size =
+      std::max(ring->sq_ring_size, ring->cq_ring_size);
+  }
+  ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+  ring->sq_ring = mmap(nullptr, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_handle,
+                       IORING_OFF_SQ_RING);
+  ring->cq_ring = single_map ?
+    ring->sq_ring :
+    mmap(nullptr, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, ring_handle, IORING_OFF_CQ_RING);
+  void* sqes = mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_handle, IORING_OFF_SQES);
+
+  if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+      sqes == MAP_FAILED) {
+    if (ring->sq_ring != MAP_FAILED) {
+      munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (!single_map && ring->cq_ring != MAP_FAILED) {
+      munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (sqes != MAP_FAILED) {
+      munmap(sqes, ring->sqes_size);
+    }
+    close(ring_handle);
+    delete ring;
+    return;
+  }
+
+  u8* sq_ring = static_cast<u8*>(ring->sq_ring);
+  ring->sq_head  = reinterpret_cast<u32*>(sq_ring + params.sq_off.head);
+  ring->sq_tail  = reinterpret_cast<u32*>(sq_ring + params.sq_off.tail);
+  ring->sq_mask  = reinterpret_cast<u32*>(sq_ring + params.sq_off.ring_mask);
+  ring->sq_array = reinterpret_cast<u32*>(sq_ring + params.sq_off.array);
+  ring->sqes     = static_cast<io_uring_sqe*>(sqes);
+
+  u8* cq_ring = static_cast<u8*>(ring->cq_ring);
+  ring->cq_head = reinterpret_cast<u32*>(cq_ring + params.cq_off.head);
+  ring->cq_tail = reinterpret_cast<u32*>(cq_ring + params.cq_off.tail);
+  ring->cq_mask = reinterpret_cast<u32*>(cq_ring + params.cq_off.ring_mask);
+  ring->cqes    = reinterpret_cast<io_uring_cqe*>(cq_ring + params.cq_off.cqes);
+
+  io_ring = ring;
+}
+
+void
+BatchFileReader::closeIoRing() {
+  if (io_ring == nullptr) {
+    return;
+  }
+  munmap(io_ring->sqes, io_ring->sqes_size);
+  if (io_ring->cq_ring != io_ring->sq_ring) {
+    munmap(io_ring->cq_ring, io_ring->cq_ring_size);
+  }
+  munmap(io_ring->sq_ring, io_ring->sq_ring_size);
+  close(io_ring->ring_handle);
+  delete io_ring;
+  io_ring = nullptr;
+}
+
+// Files move through the ring in slots: openat and statx by path are
+// submitted together, the read once both completed, and the close once
+// the file is read. Every slot holds at most two operations in the
+// ring, so at most sq_entries / 2 files are in a slot at once. Files
+// above the small file limit are only opened and stat'ed here, the pool
+// maps them like readAllWithPool() does.
+void
+BatchFileReader::readAllWithIoRing(const PathSource& next_path,
+                                   const LoadedFileHandler& on_loaded) {
+  IoRing& ring = *io_ring;
+
+  const u32 slot_count = std::min(files_in_flight, ring.sq_entries / 2);
+  std::vector<PendingFile> slots(slot_count);
+  std::vector<u32> free_slots;
+  for (u32 slot = slot_count; slot != 0; --slot) {
+    free_slots.push_back(slot - 1);
+  }
+
+  std::shared_ptr<RecycledBuffers> recycled_buffers =
+    std::make_shared<RecycledBuffers>();
+  std::shared_ptr<std::vector<std::vector<char>>> worker_buffers =
+    std::make_shared<std::vector<std::vector<char>>>(pool.workerCount());
+
+  u32 ops_in_ring = 0;
+
+  auto queueRead = [&](u32 slot) {
+    PendingFile& file = slots[slot];
+    io_uring_sqe& sqe = nextSqe(ring);
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = file.file_handle;
+    sqe.addr = reinterpret_cast<u64>(file.contents->data() + file.bytes_read);
+    sqe.len = static_cast<u32>(file.contents->size() - file.bytes_read);
+    sqe.off = file.bytes_read;
+    sqe.user_data = packUserData(slot, OP_READ);
+    queueSqe(ring);
+    ++file.ops_in_ring;
+    ++ops_in_ring;
+  };
+
+  auto queueClose = [&](u32 slot) {
+    PendingFile& file = slots[slot];
+    io_uring_sqe& sqe = nextSqe(ring);
+    sqe.opcode = IORING_OP_CLOSE;
+    sqe.fd = file.file_handle;
+    sqe.user_data = packUserData(slot, OP_CLOSE);
+    queueSqe(ring);
+    ++file.ops_in_ring;
+    ++ops_in_ring;
+  };
+
+  auto handOver = [&](u32 slot) {
+    PendingFile& file = slots[slot];
+    std::shared_ptr<std::vector<char>> contents = std::move(file.contents);
+    const std::string file_path = file.path;
+    file.handed_over = true;
+
+    beginHandling();
+    pool.submit([this, file_path, contents, recycled_buffers,
+                 &on_loaded](u32 worker) {
+      on_loaded(file_path,
+                contents->data(),
+                contents->data() + contents->size(),
+                worker);
+      recycled_buffers->give(contents);
+      endHandling();
+    });
+  };
+
+  auto handOverToMap = [&](u32 slot) {
+    const std::string file_path = slots[slot].path;
+    slots[slot].handed_over = true;
+
+    beginHandling();
+    pool.submit([this, file_path, worker_buffers, &on_loaded](u32 worker) {
+      loadFile(file_path, *worker_buffers, on_loaded, worker);
+      endHandling();
+    });
+  };
+
+  bool paths_left = true;
+  bool ring_failed = false;
+  for (;;) {
+    // Start new files while slots are free and the pool keeps up
+    while (paths_left && !free_slots.empty()) {
+      if (ops_in_ring != 0) {
+        std::unique_lock<std::mutex> guard(handling_lock);
+        if (files_handling >= files_in_flight) {
+          break; // completions still to reap, don't block on the pool
+        }
+      } else {
+        waitForHandlingBelow(files_in_flight);
+      }
+
+      std::string file_path;
+      if (!next_path(file_path)) {
+        paths_left = false;
+        break;
+      }
+
+      const u32 slot = free_slots.back();
+      free_slots.pop_back();
+      PendingFile& file = slots[slot];
+      file.path = std::move(file_path);
+      file.contents.reset();
+      file.file_handle = -1;
+      file.bytes_read = 0;
+      file.failed = false;
+      file.handed_over = false;
+      file.ops_in_ring = 2;
+      ops_in_ring += 2;
+
+      io_uring_sqe& open_sqe = nextSqe(ring);
+      open_sqe.opcode = IORING_OP_OPENAT;
+      open_sqe.fd = AT_FDCWD;
+      open_sqe.addr = reinterpret_cast<u64>(file.path.c_str());
+      open_sqe.open_flags = O_RDONLY | O_CLOEXEC;
+      open_sqe.user_data = packUserData(slot, OP_OPEN);
+      queueSqe(ring);
+
+      io_uring_sqe& stat_sqe = nextSqe(ring);
+      stat_sqe.opcode = IORING_OP_STATX;
+      stat_sqe.fd = AT_FDCWD;
+      stat_sqe.addr = reinterpret_cast<u64>(file.path.c_str());
+      stat_sqe.len = STATX_SIZE;
+      stat_sqe.off = reinterpret_cast<u64>(&file.attributes);
+      stat_sqe.user_data = packUserData(slot, OP_STAT);
+      queueSqe(ring);
+    }
+
+    if (ops_in_ring == 0) {
+      if (!paths_left) {
+        break;
+      }
+      continue;
+    }
+
+    if (ringEnter(ring, 1) < 0 && errno != EINTR && errno != EAGAIN &&
+        errno != EBUSY) {
+      ring_failed = true;
+      break;
+    }
+
+    u32 head = *ring.cq_head;
+    const u32 tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const io_uring_cqe& cqe = ring.cqes[head & *ring.cq_mask];
+      const u32 slot = static_cast<u32>(cqe.user_data >> 8);
+      const RingOp op = static_cast<RingOp>(cqe.user_data & 0xff);
+      const int result = cqe.res;
+
+      PendingFile& file = slots[slot];
+      --file.ops_in_ring;
+      --ops_in_ring;
+
+      switch (op) {
+        case OP_OPEN: {
+          if (result < 0) {
+            file.failed = true;
+          } else {
+            file.file_handle = result;
+          }
+          break;
+        }
+        case OP_STAT: {
+          if (result < 0) {
+            file.failed = true;
+          } else if (file.attributes.stx_size == 0) {
+            file.failed = true; // nothing to lex
+          }
+          break;
+        }
+        case OP_READ: {
+          if (result <= 0) {
+            // The file shrank or failed, keep what was read
+            file.contents->resize(file.bytes_read);
+            file.failed = result < 0 || file.bytes_read == 0;
+          } else {
+            file.bytes_read += result;
+            if (file.bytes_read < file.contents->size()) {
+              queueRead(slot);
+              continue;
+            }
+          }
+          if (!file.failed) {
+            handOver(slot);
+          }
+          queueClose(slot);
+          continue;
+        }
+        case OP_CLOSE: {
+          file.file_handle = -1;
+          file.path.clear();
+          free_slots.push_back(slot);
+          continue;
+        }
+      }
+
+      // Both the open and the stat completed
+      if (file.ops_in_ring == 0) {
+        if (file.failed) {
+          if (file.file_handle >= 0) {
+            queueClose(slot);
+          } else {
+            file.path.clear();
+            free_slots.push_back(slot);
+          }
+        } else if (file.attributes.stx_size > small_file_read_limit) {
+          handOverToMap(slot);
+          queueClose(slot);
+        } else {
+          file.contents = recycled_buffers->take();
+          file.contents->resize(static_cast<size_t>(file.attributes.stx_size));
+          queueRead(slot);
+        }
+      }
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  if (!ring_failed) {
+    return;
+  }
+
+  // The kernel writes into the slots until the operations it took
+  // complete, wait for those before the slots go. Operations it never
+  // took go with the ring. Sleeping also lets completions posted
+  // through task work come in.
+  u32 ops_taken = ops_in_ring - ring.to_submit;
+  while (ops_taken != 0) {
+    u32 head = *ring.cq_head;
+    const u32 tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      usleep(1000);
+      continue;
+    }
+    for (; head != tail; ++head) {
+      const io_uring_cqe& cqe = ring.cqes[head & *ring.cq_mask];
+      PendingFile& file = slots[static_cast<u32>(cqe.user_data >> 8)];
+      const RingOp op = static_cast<RingOp>(cqe.user_data & 0xff);
+      if (op == OP_OPEN && cqe.res >= 0) {
+        file.file_handle = cqe.res;
+      } else if (op == OP_CLOSE) {
+        file.file_handle = -1;
+      }
+      --ops_taken;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  // Files the ring didn't get through are read on the pool instead,
+  // after the paths still to come
+  std::vector<std::string> unread_paths;
+  for (PendingFile& file : slots) {
+    if (!file.path.empty() && !file.handed_over && !file.failed) {
+      unread_paths.push_back(file.path);
+    }
+    if (file.file_handle >= 0) {
+      close(file.file_handle);
+    }
+  }
+  closeIoRing();
+
+  size_t unread_path = 0;
+  readAllWithPool([&](std::string& path_out) {
+    if (unread_path < unread_paths.size()) {
+      path_out = std::move(unread_paths[unread_path++]);
+      return true;
+    }
+    return paths_left && next_path(path_out);
+  }, on_loaded);
+}
+
+#else // __linux__
+
+struct IoRing {};
+
+void
+BatchFileReader::openIoRing() {
+
+}
+
+void
+BatchFileReader::closeIoRing() {
+
+}
+
+void
+BatchFileReader::readAllWithIoRing(const PathSource& next_path,
+                                   const LoadedFileHandler& on_loaded) {
+  readAllWithPool(next_path, on_loaded);
+}
+
+#endif // __linux__
@@ -0,0 +1,64 @@
+
+#include "directory_listing.h"
+
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+bool
+listDirectory(const std::string& directory_path,
+              std::vector<DirectoryEntry>& entries_out) {
+  DIR* directory = opendir(directory_path.c_str());
+  if (directory == nullptr) {
+    return false;
+  }
+  const int directory_handle = dirfd(directory);
+
+  while (const dirent* entry = readdir(directory)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    // Stat relative to the open directory, saving a path lookup per entry
+    struct stat entry_attributes;
+    if (fstatat(directory_handle,
+                entry->d_name,
+                &entry_attributes,
+                AT_SYMLINK_NOFOLLOW) != 0) {
+      continue;
+    }
+    if (S_ISLNK(entry_attributes.st_mode)) {
+      continue;
+    }
+
+    DirectoryEntry listed;
+    listed.name = entry->d_name;
+    listed.is_directory = S_ISDIR(entry_attributes.st_mode);
+    listed.is_regular_file = S_ISREG(entry_attributes.st_mode);
+    listed.size = static_cast<u64>(entry_attributes.st_size);
+    listed.modification_time =
+      static_cast<u64>(entry_attributes.st_mtim.tv_sec) * 1000000000ULL +
+      static_cast<u64>(entry_attributes.st_mtim.tv_nsec);
+    entries_out.push_back(std::move(listed));
+  }
+
+  closedir(directory);
+  return true;
+}
+
+bool
+statFile(const std::string& file_path, DirectoryEntry& entry_out) {
+  struct stat file_attributes;
+  if (stat(file_path.c_str(), &file_attributes) != 0) {
+    return false;
+  }
+  entry_out.is_directory = S_ISDIR(file_attributes.st_mode);
+  entry_out.is_regular_file = S_ISREG(file_attributes.st_mode);
+  entry_out.size = static_cast<u64>(file_attributes.st_size);
+  entry_out.modification_time =
+    static_cast<u64>(file_attributes.st_mtim.tv_sec) * 1000000000ULL +
+    static_cast<u64>(file_attributes.st_mtim.tv_nsec);
+  return true;
+}
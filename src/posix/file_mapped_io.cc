@@ -1,22 +1,27 @@
 
 #include "file_mapped_io.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <iostream>
 
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 
-FileMapper::FileMapper(const char* file_path) {
+// Mappings smaller than a huge page can't be backed by one
+internal_ const u32 huge_page_size = 2 * 1024 * 1024;
+
+FileMapper::FileMapper(const char* file_path, MapAccess access) :
+    access(access) {
   mode_t file_handle_mode = O_CREAT; //Create only if exists, else use existing
   int file_handle = open(file_path,
-                    O_RDWR,
+                    access == MapAccess::READ_WRITE ? O_RDWR : O_RDONLY,
                     file_handle_mode);
 
+  handle.file_handle = file_handle;
   if (file_handle == -1) {
-    std::cerr << "File handle creation failed";
-  } else {
-    handle.file_handle = file_handle;
+    std::cerr << "File handle creation failed" << std::endl;
   }
 
   struct stat file_attributes;
@@ -42,17 +47,77 @@ FileMapper::getFileSize() {
 }
 
 void*
-FileMapper::map(u64 byte_offset, u32 length) {
+FileMapper::map(u64 byte_offset, u64 length) {
+  int map_flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if (access == MapAccess::READ_SEQUENTIAL) {
+    map_flags |= MAP_POPULATE;
+  }
+#endif
+
   void* mapped_mem = mmap(nullptr,
                           length,
-                          PROT_READ | PROT_WRITE,
-                          MAP_SHARED,
+                          access == MapAccess::READ_WRITE ?
+                            PROT_READ | PROT_WRITE :
+                            PROT_READ,
+                          map_flags,
                           handle.file_handle,
                           byte_offset);
-  return mapped_mem != MAP_FAILED ? mapped_mem : nullptr; 
+  if (mapped_mem == MAP_FAILED) {
+    return nullptr;
+  }
+
+  // Advice is only a hint, failing to take it is harmless
+  switch (access) {
+    case MapAccess::READ_SEQUENTIAL: {
+      madvise(mapped_mem, length, MADV_SEQUENTIAL);
+      madvise(mapped_mem, length, MADV_WILLNEED);
+      break;
+    }
+    case MapAccess::READ_ONLY: {
+#ifdef MADV_HUGEPAGE
+      if (length >= huge_page_size) {
+        madvise(mapped_mem, length, MADV_HUGEPAGE);
+      }
+#endif
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+  return mapped_mem;
 }
 
-void FileMapper::unmap(void* mapped_mem, u32 length) {
+bool
+FileMapper::read(u64 byte_offset, void* buffer_out, u64 length) {
+  u8* buffer_itr = static_cast<u8*>(buffer_out);
+  while (length != 0) {
+    // Linux transfers at most about 2 GiB per call anyway
+    const ssize_t bytes_read = pread(handle.file_handle,
+                                     buffer_itr,
+                                     std::min<u64>(length, 1 << 30),
+                                     byte_offset);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      return false; // failed, or the file shrank
+    }
+    buffer_itr += bytes_read;
+    byte_offset += bytes_read;
+    length -= static_cast<u64>(bytes_read);
+  }
+  return true;
+}
+
+void FileMapper::unmap(void* mapped_mem, u64 length) {
   munmap(mapped_mem, length);
 }
 
+u64
+FileMapper::mapAlignment() {
+  static const u64 page_size = static_cast<u64>(sysconf(_SC_PAGESIZE));
+  return page_size;
+}
+
@@ -0,0 +1,246 @@
+
+#include "postings.h"
+
+#include <cstring>
+
+// The SSSE3 decoding kernel is built in wherever the compiler can
+// target SSSE3. Unless the target flags enable it throughout, the kernel
+// alone is compiled for SSSE3 and only runs if the CPU supports it.
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define SSSE3_DECODING_
+#define ssse3_target_
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define SSSE3_DECODING_
+#define ssse3_target_ __attribute__((target("ssse3")))
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Per control byte: the data bytes of its group, and the shuffle moving
+// them into 4 zero extended values
+struct ControlTable {
+  ControlTable();
+
+  u8 lengths[256];
+  u8 shuffles[256][16];
+};
+
+ControlTable::ControlTable() {
+  for (u32 control = 0; control < 256; ++control) {
+    u8 data_byte = 0;
+    for (u32 value = 0; value < 4; ++value) {
+      const u32 length = ((control >> (2 * value)) & 3) + 1;
+      for (u32 byte = 0; byte < 4; ++byte) {
+        // Out of range shuffle indices, with the top bit set, give 0
+        shuffles[control][4 * value + byte] =
+          byte < length ? static_cast<u8>(data_byte + byte) : 0x80;
+      }
+      data_byte += length;
+    }
+    lengths[control] = data_byte;
+  }
+}
+
+internal_ const ControlTable control_table;
+
+#if defined(SSSE3_DECODING_)
+internal_ bool
+supportsSsse3() {
+#if defined(__SSSE3__)
+  return true;
+#else
+  // May run before the constructors which initialize the CPU model
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("ssse3") != 0;
+#endif
+}
+
+internal_ const bool has_ssse3 = supportsSsse3();
+
+// Decodes whole groups from value on while a full 16 byte load stays
+// within the bytes, and returns the value it stopped at
+internal_ ssse3_target_ u32
+decodeGroups(const u8*& control_itr,
+             const u8*& data_itr,
+             const u8* bytes_end,
+             u32 value,
+             u32 count,
+             u32* values_out) {
+  for (; value + 4 <= count && bytes_end - data_itr >= 16; value += 4) {
+    const u8 control = *control_itr++;
+    const __m128i data =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(data_itr));
+    const __m128i shuffle = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(control_table.shuffles[control]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(values_out + value),
+                     _mm_shuffle_epi8(data, shuffle));
+    data_itr += control_table.lengths[control];
+  }
+  return value;
+}
+#endif
+
+internal_ inline u32
+valueLength(u32 value) {
+  return value < (1u << 8)  ? 1 :
+         value < (1u << 16) ? 2 :
+         value < (1u << 24) ? 3 : 4;
+}
+
+u64
+encodeValues(const u32* values, u32 count, std::vector<u8>& bytes_out) {
+  const size_t control_begin = bytes_out.size();
+  bytes_out.resize(control_begin + (count + 3) / 4, 0);
+
+  for (u32 i = 0; i < count; ++i) {
+    const u32 length = valueLength(values[i]);
+    bytes_out[control_begin + i / 4] |=
+      static_cast<u8>((length - 1) << (2 * (i % 4)));
+    for (u32 byte = 0; byte < length; ++byte) {
+      bytes_out.push_back(static_cast<u8>(values[i] >> (8 * byte)));
+    }
+  }
+  return bytes_out.size() - control_begin;
+}
+
+const u8*
+decodeValues(const u8* bytes_begin,
+             const u8* bytes_end,
+             u32 count,
+             u32* values_out) {
+  const u32 group_count = (count + 3) / 4;
+  if (static_cast<u64>(bytes_end - bytes_begin) < group_count) {
+    return nullptr;
+  }
+  const u8* control_itr = bytes_begin;
+  const u8* data_itr = bytes_begin + group_count;
+
+  u32 value = 0;
+#if defined(SSSE3_DECODING_)
+  if (has_ssse3) {
+    value = decodeGroups(control_itr, data_itr, bytes_end, value, count,
+                         values_out);
+  }
+#endif
+
+  for (; value < count; ++value) {
+    const u32 length = ((*control_itr >> (2 * (value % 4))) & 3) + 1;
+    if (bytes_end - data_itr < static_cast<s64>(length)) {
+      return nullptr;
+    }
+    u32 decoded = 0;
+    for (u32 byte = 0; byte < length; ++byte) {
+      decoded |= static_cast<u32>(data_itr[byte]) << (8 * byte);
+    }
+    values_out[value] = decoded;
+    data_itr += length;
+    if (value % 4 == 3) {
+      ++control_itr;
+    }
+  }
+  return data_itr;
+}
+
+void
+deltaEncode(u32* values, u32 count) {
+  for (u32 i = count; i > 1; --i) {
+    values[i - 1] -= values[i - 2];
+  }
+}
+
+void
+prefixSum(u32* values, u32 count) {
+  u32 i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+  // Sums within 4 lanes in two shifted adds, plus the last sum so far
+  __m128i carry = _mm_setzero_si128();
+  for (; i + 4 <= count; i += 4) {
+    __m128i sums = _mm_loadu_si128(reinterpret_cast<__m128i*>(values + i));
+    sums = _mm_add_epi32(sums, _mm_slli_si128(sums, 4));
+    sums = _mm_add_epi32(sums, _mm_slli_si128(sums, 8));
+    sums = _mm_add_epi32(sums, carry);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), sums);
+    carry = _mm_shuffle_epi32(sums, 0xff);
+  }
+#endif
+  for (; i < count; ++i) {
+    values[i] += i > 0 ? values[i - 1] : 0;
+  }
+}
+
+void
+encodePostings(const Occurrence* occurrences,
+               u32 occurrence_count,
+               std::vector<u8>& postings_out,
+               SymbolEntry& entry_out) {
+  std::vector<u32> file_ids;
+  std::vector<u32> file_counts;
+  std::vector<u32> offsets(occurrence_count);
+  for (u32 i = 0; i < occurrence_count; ++i) {
+    if (file_ids.empty() || file_ids.back() != occurrences[i].file_id) {
+      file_ids.push_back(occurrences[i].file_id);
+      file_counts.push_back(0);
+    }
+    ++file_counts.back();
+    offsets[i] = occurrences[i].offset;
+  }
+
+  deltaEncode(file_ids.data(), static_cast<u32>(file_ids.size()));
+  u32* file_offsets = offsets.data();
+  for (u32 file_count : file_counts) {
+    deltaEncode(file_offsets, file_count);
+    file_offsets += file_count;
+  }
+
+  std::vector<u32> values;
+  values.reserve(2 * file_ids.size() + offsets.size());
+  values.insert(values.end(), file_ids.begin(), file_ids.end());
+  values.insert(values.end(), file_counts.begin(), file_counts.end());
+  values.insert(values.end(), offsets.begin(), offsets.end());
+
+  entry_out.postings_offset = postings_out.size();
+  entry_out.postings_size = static_cast<u32>(
+    encodeValues(values.data(), static_cast<u32>(values.size()),
+                 postings_out));
+  entry_out.file_count = static_cast<u32>(file_ids.size());
+  entry_out.occurrence_count = occurrence_count;
+  entry_out.reserved = 0;
+}
+
+bool
+decodePostings(const SymbolEntry& entry,
+               const u8* postings,
+               std::vector<Occurrence>& occurrences_out) {
+  const u64 value_count = 2 * u64(entry.file_count) + entry.occurrence_count;
+  if (entry.file_count > entry.occurrence_count || value_count > ~u32(0)) {
+    return false;
+  }
+  std::vector<u32> values(static_cast<size_t>(value_count));
+  if (decodeValues(postings, postings + entry.postings_size,
+                   static_cast<u32>(value_count), values.data()) == nullptr) {
+    return false;
+  }
+
+  u32* file_ids = values.data();
+  const u32* file_counts = file_ids + entry.file_count;
+  u32* offsets = file_ids + 2 * entry.file_count;
+  prefixSum(file_ids, entry.file_count);
+
+  u64 occurrences_left = entry.occurrence_count;
+  for (u32 file = 0; file < entry.file_count; ++file) {
+    const u32 file_count = file_counts[file];
+    if (file_count > occurrences_left) {
+      return false;
+    }
+    occurrences_left -= file_count;
+
+    prefixSum(offsets, file_count);
+    for (u32 i = 0; i < file_count; ++i) {
+      occurrences_out.push_back({file_ids[file], offsets[i]});
+    }
+    offsets += file_count;
+  }
+  return occurrences_left == 0;
+}
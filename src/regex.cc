@@ -118,3 +118,97 @@ ExpressionGroupQuantification::quantifyOnString(const char* quantifier_begin) {
   // if we make it to here, no known quantifier was found
   return 0;
 }
+
+// Walks the expression the way NFA::addExprGroup() does, e.g. a group
+// ends at the first ')' balancing its '(', escaped or not
+internal_ bool
+isValidRegexGroup(const char* begin, const char* end) {
+  const char* itr = begin;
+  while (itr != end) {
+    switch (*itr) {
+      case '\\': {
+        if (itr + 1 == end) {
+          return false;
+        }
+        itr += 2;
+        break;
+      }
+      case '(': {
+        const char* group_begin = ++itr;
+        for (int depth = 1; depth != 0; ++itr) {
+          if (itr == end) {
+            return false;
+          }
+          depth += *itr == '(' ? 1 : *itr == ')' ? -1 : 0;
+        }
+        if (!isValidRegexGroup(group_begin, itr - 1)) {
+          return false;
+        }
+        break;
+      }
+      case ')': {
+        return false;
+      }
+      case '[': {
+        ++itr;
+        if (itr != end && *itr == '^') {
+          ++itr;
+        }
+        // A range needs a character before its '-', its end may be
+        // escaped and is taken as is, even if it's ']'
+        bool range_begin = false;
+        for (; itr != end && *itr != ']'; ++itr) {
+          if (*itr == '-') {
+            if (!range_begin || ++itr == end ||
+                (*itr == '\\' && ++itr == end)) {
+              return false;
+            }
+          } else {
+            range_begin = true;
+          }
+        }
+        if (itr == end) {
+          return false;
+        }
+        ++itr;
+        break;
+      }
+      default: {
+        ++itr;
+        break;
+      }
+    }
+
+    if (itr != end) {
+      ExpressionGroupQuantification quant;
+      const int quantification_length = quant.quantifyOnString(itr);
+      if (quantification_length != 0) {
+        // A quantifier is parsed up to a '}' which may lie past the end
+        // of a group
+        if (quantification_length > end - itr ||
+            quant.min_occurrences < 0 ||
+            quant.min_occurrences > max_regex_repetitions ||
+            quant.max_occurrences > max_regex_repetitions ||
+            (quant.max_occurrences != quant.INFINITE_OCCURRENCES &&
+             quant.max_occurrences < quant.min_occurrences)) {
+          return false;
+        }
+        itr += quantification_length;
+      }
+    }
+  }
+  return true;
+}
+
+bool
+isValidRegex(const char* regex) {
+  const Regexpr expression(regex);
+  for (const char* itr = expression.expr_begin;
+       itr != expression.expr_end;
+       ++itr) {
+    if (static_cast<u8>(*itr) >= 0x80) {
+      return false;
+    }
+  }
+  return isValidRegexGroup(expression.expr_begin, expression.expr_end);
+}
@@ -0,0 +1,136 @@
+
+#include "simd_scan.h"
+
+#include <cassert>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "utils.h"
+
+internal_ inline bool
+isWhitespace(char ch) {
+  return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+const char*
+findStopByte(const char* begin,
+             const char* end,
+             const u8* stop_bytes,
+             u32 byte_count) {
+  assert(byte_count <= 3);
+
+  // Unused compare slots repeat the first stop byte, or test for a
+  // non-ASCII byte again when there are no stop bytes at all.
+  const char first = byte_count > 0 ? stop_bytes[0] : '\x80';
+  const char second = byte_count > 1 ? stop_bytes[1] : first;
+  const char third = byte_count > 2 ? stop_bytes[2] : first;
+
+  const char* itr = begin;
+
+#if defined(__AVX2__)
+  const __m256i first_bytes = _mm256_set1_epi8(first);
+  const __m256i second_bytes = _mm256_set1_epi8(second);
+  const __m256i third_bytes = _mm256_set1_epi8(third);
+  for (; end - itr >= 32; itr += 32) {
+    const __m256i block =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(itr));
+    const __m256i stops =
+      _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, first_bytes),
+                        _mm256_cmpeq_epi8(block, second_bytes)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, third_bytes), block));
+    const u32 stop_mask = static_cast<u32>(_mm256_movemask_epi8(stops));
+    if (stop_mask != 0) {
+      return itr + countTrailingZeros(stop_mask);
+    }
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  const __m128i first_bytes = _mm_set1_epi8(first);
+  const __m128i second_bytes = _mm_set1_epi8(second);
+  const __m128i third_bytes = _mm_set1_epi8(third);
+  for (; end - itr >= 16; itr += 16) {
+    const __m128i block =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(itr));
+    const __m128i stops =
+      _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(block, first_bytes),
+                     _mm_cmpeq_epi8(block, second_bytes)),
+        _mm_or_si128(_mm_cmpeq_epi8(block, third_bytes), block));
+    const u32 stop_mask = static_cast<u32>(_mm_movemask_epi8(stops));
+    if (stop_mask != 0) {
+      return itr + countTrailingZeros(stop_mask);
+    }
+  }
+#endif
+
+  for (; itr != end; ++itr) {
+    if (*itr == first || *itr == second || *itr == third ||
+        static_cast<u8>(*itr) >= 0x80) {
+      return itr;
+    }
+  }
+  return end;
+}
+
+const char*
+skipWhitespace(const char* begin, const char* end) {
+  const char* itr = begin;
+
+  // Most runs are a single space, skip SIMD setup for those
+  if (itr != end && !isWhitespace(*itr)) {
+    return itr;
+  }
+
+#if defined(__AVX2__)
+  const __m256i spaces = _mm256_set1_epi8(' ');
+  const __m256i tabs = _mm256_set1_epi8('\t');
+  const __m256i carriage_returns = _mm256_set1_epi8('\r');
+  const __m256i newlines = _mm256_set1_epi8('\n');
+  for (; end - itr >= 32; itr += 32) {
+    const __m256i block =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(itr));
+    const __m256i whitespace =
+      _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, spaces),
+                        _mm256_cmpeq_epi8(block, tabs)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, carriage_returns),
+                        _mm256_cmpeq_epi8(block, newlines)));
+    const u32 other_mask =
+      ~static_cast<u32>(_mm256_movemask_epi8(whitespace));
+    if (other_mask != 0) {
+      return itr + countTrailingZeros(other_mask);
+    }
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  const __m128i spaces = _mm_set1_epi8(' ');
+  const __m128i tabs = _mm_set1_epi8('\t');
+  const __m128i carriage_returns = _mm_set1_epi8('\r');
+  const __m128i newlines = _mm_set1_epi8('\n');
+  for (; end - itr >= 16; itr += 16) {
+    const __m128i block =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(itr));
+    const __m128i whitespace =
+      _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(block, spaces),
+                     _mm_cmpeq_epi8(block, tabs)),
+        _mm_or_si128(_mm_cmpeq_epi8(block, carriage_returns),
+                     _mm_cmpeq_epi8(block, newlines)));
+    const u32 other_mask =
+      ~static_cast<u32>(_mm_movemask_epi8(whitespace)) & 0xffff;
+    if (other_mask != 0) {
+      return itr + countTrailingZeros(other_mask);
+    }
+  }
+#endif
+
+  for (; itr != end; ++itr) {
+    if (!isWhitespace(*itr)) {
+      return itr;
+    }
+  }
+  return end;
+}
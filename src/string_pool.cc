@@ -0,0 +1,166 @@
+
+#include "string_pool.h"
+
+#include <cassert>
+#include <cstring>
+
+// Grown to keep at most half of the slots in use, which keeps probe
+// sequences short
+internal_ const u32 initial_slot_count = 1 << 10;
+
+StringPool::StringPool() :
+    string_offsets(1, 0),
+    slots(initial_slot_count, 0) {
+
+}
+
+u32
+StringPool::intern(const char* string, u32 length) {
+  if (2 * (size() + 1) > slots.size()) {
+    grow();
+  }
+
+  const u32 slot_mask = static_cast<u32>(slots.size()) - 1;
+  for (u32 slot = hashString(string, length) & slot_mask;;
+       slot = (slot + 1) & slot_mask) {
+    if (slots[slot] == 0) {
+      const u32 id = size();
+      slots[slot] = id + 1;
+      string_bytes.insert(string_bytes.end(), string, string + length);
+      string_offsets.push_back(string_bytes.size());
+      return id;
+    }
+    if (equals(slots[slot] - 1, string, length)) {
+      return slots[slot] - 1;
+    }
+  }
+}
+
+bool
+StringPool::find(const char* string, u32 length, u32& id_out) const {
+  const u32 slot_mask = static_cast<u32>(slots.size()) - 1;
+  for (u32 slot = hashString(string, length) & slot_mask;
+       slots[slot] != 0;
+       slot = (slot + 1) & slot_mask) {
+    if (equals(slots[slot] - 1, string, length)) {
+      id_out = slots[slot] - 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char*
+StringPool::string(u32 id) const {
+  assert(id < size());
+  return string_bytes.data() + string_offsets[id];
+}
+
+u32
+StringPool::length(u32 id) const {
+  assert(id < size());
+  return static_cast<u32>(string_offsets[id + 1] - string_offsets[id]);
+}
+
+u32
+StringPool::size() const {
+  return static_cast<u32>(string_offsets.size() - 1);
+}
+
+void
+StringPool::serialize(std::vector<u8>& bytes_out) const {
+  StringPoolHeader header;
+  header.string_count = size();
+  header.slot_count = static_cast<u32>(slots.size());
+  header.slots_offset = sizeof(StringPoolHeader) +
+                        string_offsets.size() * sizeof(u64);
+  header.bytes_offset = header.slots_offset + slots.size() * sizeof(u32);
+
+  const size_t section_begin = bytes_out.size();
+  bytes_out.resize(section_begin + header.bytes_offset + string_bytes.size());
+  u8* section = bytes_out.data() + section_begin;
+  memcpy(section, &header, sizeof(StringPoolHeader));
+  memcpy(section + sizeof(StringPoolHeader),
+         string_offsets.data(),
+         string_offsets.size() * sizeof(u64));
+  memcpy(section + header.slots_offset,
+         slots.data(),
+         slots.size() * sizeof(u32));
+  memcpy(section + header.bytes_offset,
+         string_bytes.data(),
+         string_bytes.size());
+}
+
+bool
+StringPool::deserialize(const u8* section, u64 size) {
+  StringPoolHeader header;
+  if (size < sizeof(StringPoolHeader)) {
+    return false;
+  }
+  memcpy(&header, section, sizeof(StringPoolHeader));
+
+  const u64 offsets_size = (u64(header.string_count) + 1) * sizeof(u64);
+  if (header.slot_count == 0 ||
+      (header.slot_count & (header.slot_count - 1)) != 0 ||
+      header.slots_offset != sizeof(StringPoolHeader) + offsets_size ||
+      header.bytes_offset !=
+        header.slots_offset + u64(header.slot_count) * sizeof(u32) ||
+      header.bytes_offset > size) {
+    return false;
+  }
+
+  std::vector<u64> section_offsets(u64(header.string_count) + 1);
+  memcpy(section_offsets.data(), section + sizeof(StringPoolHeader),
+         offsets_size);
+  const u64 bytes_size = size - header.bytes_offset;
+  for (u32 id = 0; id < header.string_count; ++id) {
+    if (section_offsets[id] > section_offsets[id + 1]) {
+      return false;
+    }
+  }
+  if (section_offsets[0] != 0 ||
+      section_offsets[header.string_count] != bytes_size) {
+    return false;
+  }
+
+  std::vector<u32> section_slots(header.slot_count);
+  memcpy(section_slots.data(), section + header.slots_offset,
+         header.slot_count * sizeof(u32));
+  // Probing ends at an empty slot, there must be one
+  bool has_empty_slot = false;
+  for (u32 slot_entry : section_slots) {
+    if (slot_entry > header.string_count) {
+      return false;
+    }
+    has_empty_slot = has_empty_slot || slot_entry == 0;
+  }
+  if (!has_empty_slot) {
+    return false;
+  }
+
+  const char* section_bytes =
+    reinterpret_cast<const char*>(section + header.bytes_offset);
+  string_bytes.assign(section_bytes, section_bytes + bytes_size);
+  string_offsets.swap(section_offsets);
+  slots.swap(section_slots);
+  return true;
+}
+
+bool
+StringPool::equals(u32 id, const char* string, u32 length) const {
+  return this->length(id) == length &&
+         memcmp(this->string(id), string, length) == 0;
+}
+
+void
+StringPool::grow() {
+  slots.assign(slots.size() * 2, 0);
+  const u32 slot_mask = static_cast<u32>(slots.size()) - 1;
+  for (u32 id = 0; id < size(); ++id) {
+    u32 slot = hashString(string(id), length(id)) & slot_mask;
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & slot_mask;
+    }
+    slots[slot] = id + 1;
+  }
+}
@@ -0,0 +1,432 @@
+
+#include "trigram_index.h"
+
+#include <algorithm>
+#include <set>
+#include <string>
+
+#include "regex.h"
+
+typedef std::set<std::string> StringSet;
+
+// String sets growing beyond this are given up on, which only weakens
+// the filter
+internal_ const size_t max_set_size = 16;
+
+// What is known about the strings a subexpression matches. Either the
+// exact set of them, or the sets of their prefixes and suffixes (at most
+// 2 bytes each, "" if unknown) along with a query every match satisfies.
+struct RegexInfo {
+  bool can_empty;
+  bool is_exact;
+  StringSet exact;
+  StringSet prefix;
+  StringSet suffix;
+  TrigramQuery match;
+};
+
+TrigramQuery::TrigramQuery() :
+    op(Op::ALL) {
+
+}
+
+void
+collectTrigrams(const char* begin,
+                const char* end,
+                std::vector<u64>& seen,
+                std::vector<u32>& trigrams_out) {
+  if (end - begin < 3) {
+    return;
+  }
+  const size_t first_trigram = trigrams_out.size();
+  u32 trigram = static_cast<u8>(begin[0]) << 8 | static_cast<u8>(begin[1]);
+  for (const char* itr = begin + 2; itr != end; ++itr) {
+    trigram = ((trigram << 8) | static_cast<u8>(*itr)) & 0xffffff;
+    u64& seen_word = seen[trigram >> 6];
+    const u64 seen_bit = u64(1) << (trigram & 63);
+    if ((seen_word & seen_bit) == 0) {
+      seen_word |= seen_bit;
+      trigrams_out.push_back(trigram);
+    }
+  }
+  for (size_t i = first_trigram; i < trigrams_out.size(); ++i) {
+    seen[trigrams_out[i] >> 6] = 0;
+  }
+}
+
+// Queries are kept flat: an AND of ANDs is one AND, likewise for OR
+internal_ TrigramQuery
+combineQueries(TrigramQuery::Op op,
+               const TrigramQuery& a,
+               const TrigramQuery& b) {
+  TrigramQuery combined;
+  combined.op = op;
+  for (const TrigramQuery* query : {&a, &b}) {
+    if (query->op == op) {
+      combined.trigrams.insert(combined.trigrams.end(),
+                               query->trigrams.begin(),
+                               query->trigrams.end());
+      combined.subqueries.insert(combined.subqueries.end(),
+                                 query->subqueries.begin(),
+                                 query->subqueries.end());
+    } else {
+      combined.subqueries.push_back(*query);
+    }
+  }
+  std::sort(combined.trigrams.begin(), combined.trigrams.end());
+  combined.trigrams.erase(std::unique(combined.trigrams.begin(),
+                                      combined.trigrams.end()),
+                          combined.trigrams.end());
+  return combined;
+}
+
+internal_ TrigramQuery
+andQuery(const TrigramQuery& a, const TrigramQuery& b) {
+  if (a.op == TrigramQuery::Op::ALL) {
+    return b;
+  }
+  if (b.op == TrigramQuery::Op::ALL) {
+    return a;
+  }
+  return combineQueries(TrigramQuery::Op::AND, a, b);
+}
+
+internal_ TrigramQuery
+orQuery(const TrigramQuery& a, const TrigramQuery& b) {
+  if (a.op == TrigramQuery::Op::ALL || b.op == TrigramQuery::Op::ALL) {
+    return TrigramQuery();
+  }
+  return combineQueries(TrigramQuery::Op::OR, a, b);
+}
+
+// Matches contain one of the strings: an OR over the strings of the AND
+// of their trigrams. Strings shorter than a trigram admit everything.
+internal_ TrigramQuery
+stringsQuery(const StringSet& strings) {
+  TrigramQuery query;
+  bool first_string = true;
+  for (const std::string& string : strings) {
+    if (string.size() < 3) {
+      return TrigramQuery();
+    }
+    TrigramQuery string_query;
+    string_query.op = TrigramQuery::Op::AND;
+    for (size_t i = 0; i + 3 <= string.size(); ++i) {
+      string_query.trigrams.push_back(static_cast<u8>(string[i]) << 16 |
+                                      static_cast<u8>(string[i + 1]) << 8 |
+                                      static_cast<u8>(string[i + 2]));
+    }
+    std::sort(string_query.trigrams.begin(), string_query.trigrams.end());
+    string_query.trigrams.erase(std::unique(string_query.trigrams.begin(),
+                                            string_query.trigrams.end()),
+                                string_query.trigrams.end());
+
+    query = first_string ? string_query : orQuery(query, string_query);
+    first_string = false;
+  }
+  return query;
+}
+
+internal_ StringSet
+cross(const StringSet& a, const StringSet& b) {
+  StringSet crossed;
+  for (const std::string& head : a) {
+    for (const std::string& tail : b) {
+      crossed.insert(head + tail);
+    }
+  }
+  return crossed;
+}
+
+internal_ StringSet
+unite(const StringSet& a, const StringSet& b) {
+  StringSet united = a;
+  united.insert(b.begin(), b.end());
+  return united;
+}
+
+internal_ TrigramQuery
+fullQuery(const RegexInfo& info) {
+  return info.is_exact ? andQuery(info.match, stringsQuery(info.exact)) :
+                         info.match;
+}
+
+// Moves what long or numerous strings tell into the match query and cuts
+// the sets back down
+internal_ void
+simplify(RegexInfo& info) {
+  if (info.is_exact && info.exact.size() > max_set_size) {
+    info.match = fullQuery(info);
+    info.prefix = info.exact;
+    info.suffix = info.exact;
+    info.exact.clear();
+    info.is_exact = false;
+  }
+  if (info.is_exact) {
+    return;
+  }
+
+  info.match = andQuery(info.match, stringsQuery(info.prefix));
+  info.match = andQuery(info.match, stringsQuery(info.suffix));
+  StringSet prefix;
+  for (const std::string& string : info.prefix) {
+    prefix.insert(string.substr(0, 2));
+  }
+  StringSet suffix;
+  for (const std::string& string : info.suffix) {
+    suffix.insert(string.size() > 2 ? string.substr(string.size() - 2) :
+                                      string);
+  }
+  info.prefix = prefix.size() <= max_set_size ? prefix : StringSet{""};
+  info.suffix = suffix.size() <= max_set_size ? suffix : StringSet{""};
+}
+
+internal_ RegexInfo
+emptyInfo() {
+  RegexInfo info;
+  info.can_empty = true;
+  info.is_exact = true;
+  info.exact.insert("");
+  return info;
+}
+
+// Any string of unknown bytes, possibly none
+internal_ RegexInfo
+unknownInfo(bool can_empty) {
+  RegexInfo info;
+  info.can_empty = can_empty;
+  info.is_exact = false;
+  info.prefix.insert("");
+  info.suffix.insert("");
+  return info;
+}
+
+internal_ RegexInfo
+concatenate(const RegexInfo& x, const RegexInfo& y) {
+  RegexInfo info;
+  info.can_empty = x.can_empty && y.can_empty;
+  info.match = andQuery(x.match, y.match);
+  if (x.is_exact && y.is_exact) {
+    info.is_exact = true;
+    info.exact = cross(x.exact, y.exact);
+    simplify(info);
+    return info;
+  }
+
+  const StringSet& x_suffix = x.is_exact ? x.exact : x.suffix;
+  const StringSet& y_prefix = y.is_exact ? y.exact : y.prefix;
+  info.is_exact = false;
+  info.prefix = x.is_exact  ? cross(x.exact, y_prefix) :
+                x.can_empty ? unite(x.prefix, y_prefix) :
+                              x.prefix;
+  info.suffix = y.is_exact  ? cross(x_suffix, y.exact) :
+                y.can_empty ? unite(y.suffix, x_suffix) :
+                              y.suffix;
+
+  // Trigrams spanning the border of x and y
+  if (x_suffix.size() * y_prefix.size() <= max_set_size) {
+    info.match = andQuery(info.match, stringsQuery(cross(x_suffix, y_prefix)));
+  } else {
+    info.match = andQuery(info.match, stringsQuery(x_suffix));
+    info.match = andQuery(info.match, stringsQuery(y_prefix));
+  }
+  simplify(info);
+  return info;
+}
+
+internal_ RegexInfo
+alternate(const RegexInfo& x, const RegexInfo& y) {
+  RegexInfo info;
+  info.can_empty = x.can_empty || y.can_empty;
+  if (x.is_exact && y.is_exact) {
+    info.is_exact = true;
+    info.exact = unite(x.exact, y.exact);
+    info.match = orQuery(x.match, y.match);
+  } else {
+    info.is_exact = false;
+    info.prefix = unite(x.is_exact ? x.exact : x.prefix,
+                        y.is_exact ? y.exact : y.prefix);
+    info.suffix = unite(x.is_exact ? x.exact : x.suffix,
+                        y.is_exact ? y.exact : y.suffix);
+    info.match = orQuery(fullQuery(x), fullQuery(y));
+  }
+  simplify(info);
+  return info;
+}
+
+// x{min_occurrences,max_occurrences}. Only the first few repetitions are
+// analyzed, the rest is taken as unknown.
+internal_ RegexInfo
+quantify(const RegexInfo& x, const ExpressionGroupQuantification& quant) {
+  const bool unbounded =
+    quant.max_occurrences == quant.INFINITE_OCCURRENCES;
+  if (quant.max_occurrences == 0) {
+    return emptyInfo();
+  }
+  if (quant.min_occurrences <= 0) {
+    return !unbounded && quant.max_occurrences == 1 ?
+             alternate(x, emptyInfo()) :
+             unknownInfo(true);
+  }
+
+  const int analyzed = std::min(quant.min_occurrences, 3);
+  RegexInfo info = x;
+  for (int repetition = 1; repetition < analyzed; ++repetition) {
+    info = concatenate(info, x);
+  }
+  if (unbounded || quant.max_occurrences > analyzed) {
+    info = concatenate(info, unknownInfo(true));
+  }
+  return info;
+}
+
+// A bracket expression at bracket, which is left past its ']'
+internal_ RegexInfo
+bracketInfo(const char*& bracket, const char* end) {
+  bool members[0x80] = {false};
+  const char* itr = bracket + 1;
+  const bool inverted = itr != end && *itr == '^';
+  if (inverted) {
+    ++itr;
+  }
+
+  u8 range_begin = 0;
+  for (; itr != end && *itr != ']'; ++itr) {
+    if (*itr == '-' && itr + 1 != end) {
+      ++itr;
+      if (*itr == '\\' && itr + 1 != end) {
+        ++itr;
+      }
+      u8 range_end = static_cast<u8>(*itr);
+      u8 range_first = std::min(range_begin, range_end);
+      range_end = std::max(range_begin, range_end);
+      for (u32 ch = range_first; ch <= range_end && ch < 0x80; ++ch) {
+        members[ch] = true;
+      }
+    } else {
+      range_begin = static_cast<u8>(*itr);
+      if (range_begin < 0x80) {
+        members[range_begin] = true;
+      }
+    }
+  }
+  bracket = itr != end ? itr + 1 : end;
+
+  RegexInfo info;
+  info.can_empty = false;
+  info.is_exact = true;
+  for (u32 ch = 0; ch < 0x80; ++ch) {
+    if (members[ch] != inverted) {
+      info.exact.insert(std::string(1, static_cast<char>(ch)));
+    }
+  }
+  if (info.exact.empty() || info.exact.size() > max_set_size) {
+    return unknownInfo(false);
+  }
+  return info;
+}
+
+internal_ RegexInfo analyzeAlternation(const char* begin, const char* end);
+
+// One branch of an alternation, a sequence of quantified atoms
+internal_ RegexInfo
+analyzeConcatenation(const char* begin, const char* end) {
+  RegexInfo info = emptyInfo();
+  const char* itr = begin;
+  while (itr != end) {
+    RegexInfo atom;
+    switch (*itr) {
+      case '\\': {
+        ++itr;
+        atom = emptyInfo();
+        if (itr != end) {
+          atom.exact = {std::string(1, *itr)};
+          atom.can_empty = false;
+          ++itr;
+        }
+        break;
+      }
+      case '(': {
+        const char* group_begin = ++itr;
+        for (int depth = 1; itr != end; ++itr) {
+          if (*itr == '\\' && itr + 1 != end) {
+            ++itr;
+          } else if (*itr == '(') {
+            ++depth;
+          } else if (*itr == ')' && --depth == 0) {
+            break;
+          }
+        }
+        atom = analyzeAlternation(group_begin, itr);
+        if (itr != end) {
+          ++itr;
+        }
+        break;
+      }
+      case '[': {
+        atom = bracketInfo(itr, end);
+        break;
+      }
+      case '.': {
+        atom = unknownInfo(false);
+        ++itr;
+        break;
+      }
+      default: {
+        atom = emptyInfo();
+        atom.exact = {std::string(1, *itr)};
+        atom.can_empty = false;
+        ++itr;
+        break;
+      }
+    }
+
+    if (itr != end) {
+      ExpressionGroupQuantification quant;
+      const int quantification_length = quant.quantifyOnString(itr);
+      if (quantification_length != 0) {
+        atom = quantify(atom, quant);
+        itr += quantification_length;
+      }
+    }
+    info = concatenate(info, atom);
+  }
+  return info;
+}
+
+internal_ RegexInfo
+analyzeAlternation(const char* begin, const char* end) {
+  RegexInfo info;
+  bool first_branch = true;
+  const char* branch_begin = begin;
+  int depth = 0;
+  for (const char* itr = begin; ; ++itr) {
+    if (itr == end || (*itr == '|' && depth == 0)) {
+      const RegexInfo branch = analyzeConcatenation(branch_begin, itr);
+      info = first_branch ? branch : alternate(info, branch);
+      first_branch = false;
+      if (itr == end) {
+        return info;
+      }
+      branch_begin = itr + 1;
+    } else if (*itr == '\\' && itr + 1 != end) {
+      ++itr;
+    } else if (*itr == '(') {
+      ++depth;
+    } else if (*itr == ')') {
+      --depth;
+    } else if (*itr == '[') {
+      // '|' and parentheses within brackets are plain bytes
+      while (itr + 1 != end && *(itr + 1) != ']') {
+        ++itr;
+      }
+    }
+  }
+}
+
+TrigramQuery
+regexTrigramQuery(const char* regex) {
+  const Regexpr expression(regex);
+  return fullQuery(analyzeAlternation(expression.expr_begin,
+                                      expression.expr_end));
+}
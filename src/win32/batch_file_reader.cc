@@ -0,0 +1,23 @@
+
+#include "batch_file_reader.h"
+
+// Windows has no io_uring, files are read by the pool's workers. An
+// I/O completion port backend would slot in here.
+
+struct IoRing {};
+
+void
+BatchFileReader::openIoRing() {
+
+}
+
+void
+BatchFileReader::closeIoRing() {
+
+}
+
+void
+BatchFileReader::readAllWithIoRing(const PathSource& next_path,
+                                   const LoadedFileHandler& on_loaded) {
+  readAllWithPool(next_path, on_loaded);
+}
@@ -0,0 +1,68 @@
+
+#include "directory_listing.h"
+
+#include <cstring>
+
+#include "Windows.h"
+
+#include "types.h"
+
+bool
+listDirectory(const std::string& directory_path,
+              std::vector<DirectoryEntry>& entries_out) {
+  const std::string search_pattern = directory_path + "\\*";
+
+  WIN32_FIND_DATAA entry;
+  HANDLE search_handle = FindFirstFileA(search_pattern.c_str(), &entry);
+  if (search_handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  do {
+    if (strcmp(entry.cFileName, ".") == 0 ||
+        strcmp(entry.cFileName, "..") == 0) {
+      continue;
+    }
+    if (entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+      continue;
+    }
+
+    DirectoryEntry listed;
+    listed.name = entry.cFileName;
+    listed.is_directory =
+      (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    listed.is_regular_file =
+      !listed.is_directory &&
+      (entry.dwFileAttributes & FILE_ATTRIBUTE_DEVICE) == 0;
+    listed.size = (static_cast<u64>(entry.nFileSizeHigh) << 32) |
+                  entry.nFileSizeLow;
+    listed.modification_time =
+      (static_cast<u64>(entry.ftLastWriteTime.dwHighDateTime) << 32) |
+      entry.ftLastWriteTime.dwLowDateTime;
+    entries_out.push_back(std::move(listed));
+  } while (FindNextFileA(search_handle, &entry));
+
+  FindClose(search_handle);
+  return true;
+}
+
+bool
+statFile(const std::string& file_path, DirectoryEntry& entry_out) {
+  WIN32_FILE_ATTRIBUTE_DATA attributes;
+  if (!GetFileAttributesExA(file_path.c_str(),
+                            GetFileExInfoStandard,
+                            &attributes)) {
+    return false;
+  }
+  entry_out.is_directory =
+    (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+  entry_out.is_regular_file =
+    !entry_out.is_directory &&
+    (attributes.dwFileAttributes & FILE_ATTRIBUTE_DEVICE) == 0;
+  entry_out.size = (static_cast<u64>(attributes.nFileSizeHigh) << 32) |
+                   attributes.nFileSizeLow;
+  entry_out.modification_time =
+    (static_cast<u64>(attributes.ftLastWriteTime.dwHighDateTime) << 32) |
+    attributes.ftLastWriteTime.dwLowDateTime;
+  return true;
+}
@@ -1,6 +1,7 @@
 
 #include "file_mapped_io.h"
 
+#include <algorithm>
 #include <iostream>
 
 #include "Windows.h"
@@ -10,20 +11,26 @@
 
 internal_ const u64 file_fill_size = 1024ULL;
 
-FileMapper::FileMapper(const char* file_path) {
-  u64 file_size;
+FileMapper::FileMapper(const char* file_path, MapAccess access) :
+    access(access) {
+  const bool read_only = access != MapAccess::READ_WRITE;
+
+  u64 file_size = 0;
   HANDLE file_handle = CreateFile(file_path,
-                                  GENERIC_READ | GENERIC_WRITE,
+                                  read_only ? GENERIC_READ :
+                                              GENERIC_READ | GENERIC_WRITE,
                                   FILE_SHARE_READ, 
                                   NULL,
-                                  OPEN_ALWAYS,
-                                  FILE_ATTRIBUTE_NORMAL,
+                                  read_only ? OPEN_EXISTING : OPEN_ALWAYS,
+                                  access == MapAccess::READ_SEQUENTIAL ?
+                                    FILE_FLAG_SEQUENTIAL_SCAN :
+                                    FILE_ATTRIBUTE_NORMAL,
                                   NULL);
 
   if (file_handle == INVALID_HANDLE_VALUE) {
     std::cerr << "File handle creation failed: ";
     std::cerr << GetLastError() << std::endl;
-  } else if (ERROR_ALREADY_EXISTS == GetLastError()) {
+  } else if (read_only || ERROR_ALREADY_EXISTS == GetLastError()) {
     LARGE_INTEGER file_size_tmp;
     GetFileSizeEx(file_handle, &file_size_tmp);
     file_size = file_size_tmp.QuadPart; 
@@ -31,6 +38,25 @@ FileMapper::FileMapper(const char* file_path) {
     file_size = 0; 
   }
 
+  if (read_only) {
+    // Read only mappings can't grow the file, they span it exactly
+    HANDLE map_handle = NULL;
+    if (file_size != 0) {
+      map_handle = CreateFileMapping(file_handle,
+                                     NULL,
+                                     PAGE_READONLY,
+                                     0,
+                                     0,
+                                     NULL);
+      if (map_handle == NULL) {
+        std::cerr << "File map handle creation failed: ";
+        std::cerr << GetLastError() << std::endl;
+      }
+    }
+    handle = { map_handle, file_size, file_handle };
+    return;
+  }
+
   u32 low_order_val, high_order_val;
 
   if (file_size == 0) {
@@ -51,27 +77,34 @@ FileMapper::FileMapper(const char* file_path) {
     std::cerr << GetLastError() << std::endl;
   }
   //TODO: Can file_handle be closed here?
-  handle = { map_handle, file_size ? file_size : file_fill_size };
+  handle = { map_handle, file_size ? file_size : file_fill_size, file_handle };
 }
 
 FileMapper::~FileMapper() {
-  CloseHandle(handle.file_handle);
+  if (handle.file_handle != NULL) {
+    CloseHandle(handle.file_handle);
+  }
+  if (handle.disk_handle != INVALID_HANDLE_VALUE) {
+    CloseHandle(handle.disk_handle);
+  }
 }
 
 u64 FileMapper::getFileSize() {
   return handle.file_size;
 }
 
-void* FileMapper::map(u64 byte_offset, u32 length) {
+void* FileMapper::map(u64 byte_offset, u64 length) {
   u32 low_order;
   u32 high_order;
   unpack(byte_offset, high_order, low_order);
 
   void* result = MapViewOfFile(handle.file_handle,
-                               FILE_MAP_WRITE,
+                               access == MapAccess::READ_WRITE ?
+                                 FILE_MAP_WRITE :
+                                 FILE_MAP_READ,
                                high_order,
                                low_order,
-                               length);
+                               static_cast<SIZE_T>(length));
 
   if (result == NULL) {
     std::cerr << "Mapping file to memory failed: ";
@@ -80,7 +113,34 @@ void* FileMapper::map(u64 byte_offset, u32 length) {
   return result;
 }
 
-void FileMapper::unmap(void* mapped_mem, u32 length) {
+bool FileMapper::read(u64 byte_offset, void* buffer_out, u64 length) {
+  u8* buffer_itr = static_cast<u8*>(buffer_out);
+  while (length != 0) {
+    u32 low_order;
+    u32 high_order;
+    unpack(byte_offset, high_order, low_order);
+
+    OVERLAPPED read_position = {};
+    read_position.Offset = low_order;
+    read_position.OffsetHigh = high_order;
+
+    DWORD bytes_read = 0;
+    if (!ReadFile(handle.disk_handle,
+                  buffer_itr,
+                  static_cast<DWORD>(std::min<u64>(length, 1 << 30)),
+                  &bytes_read,
+                  &read_position) ||
+        bytes_read == 0) {
+      return false;
+    }
+    buffer_itr += bytes_read;
+    byte_offset += bytes_read;
+    length -= bytes_read;
+  }
+  return true;
+}
+
+void FileMapper::unmap(void* mapped_mem, u64 length) {
   BOOL success = UnmapViewOfFile(mapped_mem);
   if (!success) {
     std::cerr << "Unmapping file from memory failed: ";
@@ -88,3 +148,11 @@ void FileMapper::unmap(void* mapped_mem, u32 length) {
   }
 }
 
+u64 FileMapper::mapAlignment() {
+  static const u64 allocation_granularity = [] {
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return static_cast<u64>(system_info.dwAllocationGranularity);
+  }();
+  return allocation_granularity;
+}
@@ -0,0 +1,173 @@
+
+#include "work_stealing_pool.h"
+
+// Pool and worker index of the calling thread, nullptr off the pool
+internal_ thread_local WorkStealingPool* current_pool = nullptr;
+internal_ thread_local u32 current_worker = 0;
+
+WorkStealingPool::WorkStealingPool(u32 worker_count) :
+    queued_count(0),
+    pending_count(0),
+    next_queue(0),
+    stopping(false) {
+  if (worker_count == 0) {
+    worker_count = std::thread::hardware_concurrency();
+    if (worker_count == 0) {
+      worker_count = 1;
+    }
+  }
+
+  for (u32 worker = 0; worker < worker_count; ++worker) {
+    queues.emplace_back(new WorkerQueue);
+  }
+  for (u32 worker = 0; worker < worker_count; ++worker) {
+    workers.emplace_back(&WorkStealingPool::workerLoop, this, worker);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  wait();
+  {
+    std::lock_guard<std::mutex> guard(state_lock);
+    stopping = true;
+  }
+  work_available.notify_all();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+void
+WorkStealingPool::submit(Task task) {
+  const u32 queue = current_pool == this ?
+                      current_worker :
+                      next_queue++ % queues.size();
+
+  pending_count.fetch_add(1);
+  {
+    std::lock_guard<std::mutex> guard(queues[queue]->lock);
+    queues[queue]->tasks.push_back(std::move(task));
+  }
+  {
+    // Taking the lock orders the count against a worker about to sleep
+    std::lock_guard<std::mutex> guard(state_lock);
+    queued_count.fetch_add(1);
+  }
+  work_available.notify_one();
+}
+
+void
+WorkStealingPool::wait() {
+  std::unique_lock<std::mutex> guard(state_lock);
+  all_done.wait(guard, [this] { return pending_count.load() == 0; });
+}
+
+void
+WorkStealingPool::parallelFor(
+    size_t count,
+    const std::function<void(size_t i, u32 worker)>& body) {
+  std::atomic<size_t> remaining(count);
+
+  for (size_t i = 0; i < count; ++i) {
+    submit([this, i, &body, &remaining](u32 worker) {
+      body(i, worker);
+      if (remaining.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> guard(state_lock);
+        all_done.notify_all();
+      }
+    });
+  }
+
+  if (current_pool == this) {
+    // Blocking here could starve the pool of the very worker the batch
+    // needs, so help out until the batch is done.
+    while (remaining.load() != 0) {
+      if (!tryRunTask(current_worker)) {
+        std::this_thread::yield();
+      }
+    }
+  } else {
+    std::unique_lock<std::mutex> guard(state_lock);
+    all_done.wait(guard, [&remaining] { return remaining.load() == 0; });
+  }
+}
+
+u32
+WorkStealingPool::workerCount() {
+  return static_cast<u32>(workers.size());
+}
+
+bool
+WorkStealingPool::popTask(u32 worker, Task& task_out) {
+  {
+    WorkerQueue& own = *queues[worker];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (!own.tasks.empty()) {
+      task_out = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+
+  // Steal, starting at the next worker so victims are spread out
+  const size_t queue_count = queues.size();
+  for (size_t offset = 1; offset < queue_count; ++offset) {
+    WorkerQueue& victim = *queues[(worker + offset) % queue_count];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (!victim.tasks.empty()) {
+      task_out = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+// Runs a task whose queued_count the caller has already claimed
+void
+WorkStealingPool::runTask(u32 worker) {
+  // The claimed count guarantees a task sits in some deque
+  Task task;
+  while (!popTask(worker, task)) {
+    std::this_thread::yield();
+  }
+  task(worker);
+
+  if (pending_count.fetch_sub(1) == 1) {
+    std::lock_guard<std::mutex> guard(state_lock);
+    all_done.notify_all();
+  }
+}
+
+bool
+WorkStealingPool::tryRunTask(u32 worker) {
+  {
+    std::lock_guard<std::mutex> guard(state_lock);
+    if (queued_count.load() == 0) {
+      return false;
+    }
+    queued_count.fetch_sub(1);
+  }
+  runTask(worker);
+  return true;
+}
+
+void
+WorkStealingPool::workerLoop(u32 worker) {
+  current_pool = this;
+  current_worker = worker;
+
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> guard(state_lock);
+      work_available.wait(guard, [this] {
+        return stopping || queued_count.load() != 0;
+      });
+      if (queued_count.load() == 0) {
+        return; // stopping with nothing left to run
+      }
+      queued_count.fetch_sub(1);
+    }
+    runTask(worker);
+  }
+}